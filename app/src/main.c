@@ -1,10 +1,19 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "app/config.h"
+#include "bf2c/bfir.h"
+#include "bf2c/cache.h"
 #include "bf2c/c_emitter.h"
+#include "bf2c/exec.h"
+#include "bf2c/interpreter.h"
+#include "bf2c/options.h"
+#include "bf2c/pass.h"
 #include "bf2c/parser.h"
 #include "bf2c/program.h"
+#include "bf2c/source.h"
 #include "cli/cli.h"
 #include "cli/error_codes.h"
 #include "cli/param.h"
@@ -17,18 +26,194 @@
 #define DEFAULT_LOG_LEVEL LOG_LEVEL_DEBUG
 #endif
 
+enum {
+    // stdin is consumed in blocks of (at most) this size, each block is emitted as soon as possible
+    STREAM_BLOCK_SIZE = 1 << 16,
+    // for the cache salt, i.e. the version and the pass pipeline
+    SALT_SIZE = 1024
+};
+
+#define STRINGIFY_IMPL(x) #x
+#define STRINGIFY(x)      STRINGIFY_IMPL(x)
+// everything besides the source which the cached programs depend on
+#define CACHE_SALT                                                                                 \
+    PROJECT_NAME " " STRINGIFY(VERSION_MAJOR) "." STRINGIFY(VERSION_MINOR) "." STRINGIFY(      \
+        VERSION_PATCH) " " GIT_HASH
+
 CLI_SETUP(
     PROJECT_NAME,
     "A Brainfuck to C transpiler",
     CLI_VERSION(VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, EXTRA_VERSION_INFO),
     CLI_POSITIONAL_ARG("input", STRING, NULL, "\tInput file. Uses stdin, if not provided."),
     CLI_OPTION("output", 'o', "FILE", STRING, NULL, "\tOutput file. Uses stdout, if not provided."),
+    CLI_FLAG("run", 'r', "\t\tRun the program instead of transpiling it (also: bf2c run ...)."),
+    CLI_FLAG("exec", 'x', "\t\tCompile the program with a C compiler and run it (bf2c exec ...)."),
     CLI_OPTION("text", 't', "CODE", STRING, NULL, "\tInput Brainfuck code as a string."),
+    CLI_OPTION("threads", 'j', "N", INT, 1, "\tNumber of threads used to parse large input files."),
+    CLI_OPTION("save-ir", '\0', "FILE", STRING, NULL, "\tAlso save the program as .bfir file."),
+    CLI_OPTION("cache-dir", '\0', "DIR", STRING, NULL, "\tCache programs and executables in DIR."),
+    CLI_OPTION("cache-size", '\0', "MB", INT, 256, "\tSize limit of the cache directory."),
+    CLI_OPTION("opt-level",
+               'O',
+               "LEVEL",
+               INT,
+               BF2C_OPT_LEVEL_DEFAULT,
+               "\tOptimization level from 0 (none) to 3 (all passes)."),
+    CLI_FLAG("stats", '\0', "\t\tPrint the commands, loops and time of every pass."),
+    CLI_OPTION("eval-steps",
+               '\0',
+               "N",
+               INT,
+               BF2C_EVAL_STEPS,
+               "\tCommands run at transpile time to precompute the output (0 disables it)."),
+    CLI_OPTION("tape-size", '\0', "N", INT, BF2C_TAPE_SIZE, "\tNumber of cells of the tape."),
+    CLI_OPTION("cell-bits", '\0', "BITS", INT, 8, "\tWidth of a cell: 8, 16 or 32 bits."),
+    CLI_OPTION("engine",
+               '\0',
+               "NAME",
+               STRING,
+               "tiered",
+               "\tEngine of --run: interpreter, jit or tiered (compiles hot loops)."),
+    CLI_FLAG("mmap-tape", '\0', "\t\tMap the tape lazily between guard pages (large tapes)."),
+    CLI_OPTION("cc",
+               '\0',
+               "CMD",
+               STRING,
+               NULL,
+               "\t\tC compiler of --exec. Uses $CC or " BF2C_DEFAULT_CC ", if not provided."),
+    CLI_OPTION("cflags",
+               '\0',
+               "FLAGS",
+               STRING,
+               BF2C_DEFAULT_CFLAGS,
+               "\tFlags of the C compiler of --exec."),
     COMMON_OPTIONS())
 
+// Parse and emit a program incrementally, so the output starts before the input is complete and
+// memory stays bounded by the largest top-level loop rather than by the whole program.
+// Only passes which do not depend on the program start are applied to the fragments.
+static bool transpile_stream(FILE* input, FILE* output, bf2c_pass_manager_t* passes) {
+    char* buffer = malloc(STREAM_BLOCK_SIZE);
+    if (!buffer) {
+        LOG_ERROR_MSG("Failed to allocate read buffer.");
+        return false;
+    }
+    bf2c_parser_t parser = bf2c_parser_create();
+    bf2c_emitter_t emitter;
+    bool success   = bf2c_emitter_begin(&emitter, output, &passes->options);
+    bool error     = false;
+    size_t ret_val = 0;
+    while (success && (ret_val = bf2c_source_read_block(input, buffer, STREAM_BLOCK_SIZE, &error)))
+    {
+        bf2c_parser_feed(&parser, buffer, ret_val);
+        program_t completed = bf2c_parser_take_completed(&parser);
+        bf2c_pass_manager_run(passes, &completed);
+        success = bf2c_emitter_emit(&emitter, &completed) && fflush(output) == 0;
+        bf2c_program_destroy(&completed);
+    }
+    free(buffer);
+    if (error) {
+        LOG_ERROR_MSG("Error reading input");
+        success = false;
+    }
+    if (!success) {
+        bf2c_parser_destroy(&parser);
+        bf2c_emitter_destroy(&emitter);
+        return false;
+    }
+    program_t rest = bf2c_parser_finish(&parser);
+    bf2c_pass_manager_run(passes, &rest);
+    success = bf2c_emitter_emit(&emitter, &rest) && bf2c_emitter_end(&emitter);
+    bf2c_program_destroy(&rest);
+    bf2c_emitter_destroy(&emitter);
+    return success;
+}
+
+static program_t parse_program(char const* input_file, char const* text, int threads) {
+    return text          ? bf2c_parse_text(text)
+           : !input_file ? bf2c_parse_file(stdin)
+           : threads > 1 ? bf2c_parse_file_by_name_parallel(input_file, (size_t) threads)
+                         : bf2c_parse_file_by_name(input_file);
+}
+
+static program_t optimize_program(char const* input_file,
+                                  char const* text,
+                                  int threads,
+                                  bf2c_pass_manager_t* passes) {
+    program_t program = parse_program(input_file, text, threads);
+    bf2c_pass_manager_run(passes, &program);
+    return program;
+}
+
+// Read the complete program from a .bfir file, a Brainfuck file, a text or stdin.
+// Parsed programs are optimized by the passes. .bfir files are used as they are, as they were
+// (usually) saved after running the passes. Programs from texts and regular files are looked up
+// in the cache first, if one is given. The salt has to describe the passes.
+static bool read_program(char const* input_file,
+                         char const* text,
+                         int threads,
+                         bf2c_pass_manager_t* passes,
+                         bf2c_cache_t* cache,
+                         char const* salt,
+                         program_t* program) {
+    if (input_file && bf2c_bfir_has_extension(input_file)) {
+        return bf2c_bfir_load_from_filename(input_file, &passes->options, program);
+    }
+    bf2c_source_t source = {0};
+    if (cache && text) {
+        source = (bf2c_source_t){text, strlen(text), false};
+    } else if (!cache || !input_file || !bf2c_source_map_file(&source, input_file)) {
+        // no cache, or not a regular file which could be hashed without consuming it
+        *program = optimize_program(input_file, text, threads, passes);
+        return true;
+    }
+    bf2c_cache_key_t const key = bf2c_cache_key(source.data, source.size, salt);
+    if (!bf2c_cache_load(cache, key, &passes->options, program)) {
+        *program = optimize_program(input_file, text, threads, passes);
+        (void) bf2c_cache_store(cache, key, &passes->options, program);
+    }
+    bf2c_source_unmap(&source);
+    return true;
+}
+
+// Run the program with the interpreter, reading stdin and writing to the output file or stdout.
+static bool run_program(program_t const* program,
+                        bf2c_options_t const* options,
+                        char const* output_file) {
+    FILE* output = output_file ? fopen(output_file, "wb") : stdout;
+    if (!output) {
+        LOG_ERROR("Failed to open output file: %s", output_file);
+        return false;
+    }
+    bool const success = bf2c_execute(program, options, bf2c_io_from_files(stdin, output));
+    if (output != stdout) {
+        return fclose(output) == 0 && success;
+    }
+    return success;
+}
+
+// Run the compiled program, reading stdin and writing to the output file or stdout. Replaces this
+// process where the platform allows it, otherwise returns the exit status of the program.
+static int exec_program(char const* executable, char const* output_file) {
+    if (output_file && !freopen(output_file, "wb", stdout)) {
+        LOG_ERROR("Failed to open output file: %s", output_file);
+        return CLI_ERROR;
+    }
+    int status = 0;
+    return bf2c_exec_run(executable, &status) ? status : CLI_ERROR;
+}
+
 int main(int argc, char* argv[]) {
     LOGGING_INIT(DEFAULT_LOG_LEVEL);
     CLI_INIT(cli);
+    // "bf2c run ..." is short for "bf2c --run ...", the same for exec
+    char run_flag[]  = "--run";
+    char exec_flag[] = "--exec";
+    if (argc > 1 && strcmp(argv[1], "run") == 0) {
+        argv[1] = run_flag;
+    } else if (argc > 1 && strcmp(argv[1], "exec") == 0) {
+        argv[1] = exec_flag;
+    }
 
     { // scoped to minimize lifetime of variables
         cli_result_t res = cli_parse_args(cli, argc, argv);
@@ -58,6 +243,21 @@ int main(int argc, char* argv[]) {
         char const* input_file  = cli_param_get_string(cli_get_param_by_name(cli, "input"));
         char const* output_file = cli_param_get_string(cli_get_param_by_name(cli, "output"));
         char const* text        = cli_param_get_string(cli_get_param_by_name(cli, "text"));
+        bool const run          = cli_param_get_bool(cli_get_param_by_name(cli, "run"));
+        bool const exec         = cli_param_get_bool(cli_get_param_by_name(cli, "exec"));
+        int const threads       = cli_param_get_int(cli_get_param_by_name(cli, "threads"));
+        char const* ir_file     = cli_param_get_string(cli_get_param_by_name(cli, "save-ir"));
+        char const* cache_dir   = cli_param_get_string(cli_get_param_by_name(cli, "cache-dir"));
+        int const cache_size    = cli_param_get_int(cli_get_param_by_name(cli, "cache-size"));
+        int const eval_steps    = cli_param_get_int(cli_get_param_by_name(cli, "eval-steps"));
+        int const opt_level     = cli_param_get_int(cli_get_param_by_name(cli, "opt-level"));
+        bool const print_stats  = cli_param_get_bool(cli_get_param_by_name(cli, "stats"));
+        int const tape_size     = cli_param_get_int(cli_get_param_by_name(cli, "tape-size"));
+        int const cell_bits     = cli_param_get_int(cli_get_param_by_name(cli, "cell-bits"));
+        bool const mmap_tape    = cli_param_get_bool(cli_get_param_by_name(cli, "mmap-tape"));
+        char const* engine      = cli_param_get_string(cli_get_param_by_name(cli, "engine"));
+        char const* cc          = cli_param_get_string(cli_get_param_by_name(cli, "cc"));
+        char const* cflags      = cli_param_get_string(cli_get_param_by_name(cli, "cflags"));
         if (input_file && text) {
             LOG_ERROR_MSG("Specified both an input file and a text string. "
                           "Please specify only one of them.");
@@ -66,19 +266,116 @@ int main(int argc, char* argv[]) {
             CLI_DEINIT();
             return CLI_ERROR_INVALID_ARGUMENT;
         }
+        if (opt_level < 0 || opt_level > BF2C_OPT_LEVEL_MAX) {
+            LOG_ERROR("Invalid optimization level: %d", opt_level);
+            cli_print_usage(cli);
+            CLI_DEINIT();
+            return CLI_ERROR_INVALID_ARGUMENT;
+        }
+        if (cache_size <= 0) {
+            LOG_ERROR("Invalid cache size: %d MB", cache_size);
+            cli_print_usage(cli);
+            CLI_DEINIT();
+            return CLI_ERROR_INVALID_ARGUMENT;
+        }
+        if (run && exec) {
+            LOG_ERROR_MSG("Specified both --run and --exec. Please specify only one of them.");
+            cli_print_usage(cli);
+            CLI_DEINIT();
+            return CLI_ERROR_INVALID_ARGUMENT;
+        }
+
+        bf2c_options_t options = bf2c_options_default();
+        options.eval_steps     = eval_steps > 0 ? (uint64_t) eval_steps : 0;
+        options.tape_size      = tape_size > 0 ? (size_t) tape_size : 0;
+        options.cell_bits      = cell_bits > 0 ? (unsigned) cell_bits : 0;
+        options.mmap_tape      = mmap_tape;
+        if (!bf2c_options_are_valid(&options)) {
+            LOG_ERROR("Invalid tape: %d cells of %d bits", tape_size, cell_bits);
+            cli_print_usage(cli);
+            CLI_DEINIT();
+            return CLI_ERROR_INVALID_ARGUMENT;
+        }
+        if (!bf2c_engine_from_string(engine, &options.engine)) {
+            LOG_ERROR("Invalid engine: %s", engine);
+            cli_print_usage(cli);
+            CLI_DEINIT();
+            return CLI_ERROR_INVALID_ARGUMENT;
+        }
+        // executables are always cached, as they are expensive to build
+        char* default_cache_dir = exec && !cache_dir ? bf2c_exec_cache_directory() : NULL;
+        if (exec && !cache_dir && !default_cache_dir) {
+            LOG_ERROR_MSG("No cache directory for --exec. Please specify --cache-dir.");
+            CLI_DEINIT();
+            return CLI_ERROR_INVALID_ARGUMENT;
+        }
+        cache_dir = cache_dir ? cache_dir : default_cache_dir;
+        bf2c_compiler_t compiler = bf2c_compiler_default();
+        compiler.command         = cc ? cc : compiler.command;
+        compiler.flags           = cflags;
 
         LOG_DEBUG("Input: %s", input_file ? input_file : text ? "text" : "stdin");
         LOG_DEBUG("Output: %s", output_file ? output_file : "stdout");
+        LOG_DEBUG("Optimization level: %d", opt_level);
+        bf2c_pass_manager_t passes = bf2c_pass_manager_create(options);
+        bool success               = false;
+        char* executable           = NULL;
         if (!input_file && !text) {
             LOG_INFO_MSG("Reading from stdin. Press Ctrl+D to finish.");
         }
-        program_t prog = input_file ? bf2c_parse_file_by_name(input_file)
-                         : text     ? bf2c_parse_text(text)
-                                    : bf2c_parse_file(stdin);
-        return_value   = output_file ? bf2c_emit_c_to_filename(output_file, &prog)
-                                     : bf2c_emit_c_to_file(stdout, &prog);
+        if (!input_file && !text && !ir_file && !run && !exec) {
+            FILE* output = output_file ? fopen(output_file, "w") : stdout;
+            bf2c_pass_manager_add_fragment_level(&passes, opt_level);
+            if (output) {
+                success = transpile_stream(stdin, output, &passes);
+                if (output != stdout) {
+                    (void) fclose(output);
+                }
+            }
+        } else {
+            bf2c_cache_t cache = {0};
+            if (cache_dir) {
+                cache = bf2c_cache_create(cache_dir, (uint64_t) cache_size << 20);
+            }
+            bf2c_pass_manager_add_level(&passes, opt_level);
+            char salt[SALT_SIZE];
+            size_t const length = strlen(CACHE_SALT " ");
+            memcpy(salt, CACHE_SALT " ", length);
+            (void) bf2c_pass_manager_describe(&passes, salt + length, sizeof(salt) - length);
 
-        bf2c_program_destroy(&prog);
+            program_t prog = {0};
+            success        = read_program(
+                input_file, text, threads, &passes, cache_dir ? &cache : NULL, salt, &prog);
+            if (success && ir_file && !bf2c_bfir_write_to_filename(ir_file, &prog, &options)) {
+                LOG_ERROR("Failed to write IR file: %s", ir_file);
+                success = false;
+            }
+            if (run) {
+                success = success && run_program(&prog, &options, output_file);
+            } else if (exec) {
+                executable =
+                    success ? bf2c_exec_build(&cache, &prog, &options, compiler, salt) : NULL;
+                success = executable != NULL;
+            } else {
+                success = success && (output_file
+                                          ? bf2c_emit_c_to_filename(output_file, &prog, &options)
+                                          : bf2c_emit_c_to_file(stdout, &prog, &options));
+            }
+            bf2c_program_destroy(&prog);
+            if (cache_dir) {
+                bf2c_cache_log_stats(&cache);
+            }
+        }
+        if (print_stats) {
+            bf2c_pass_manager_print_stats(&passes, stderr);
+        }
+        bf2c_pass_manager_destroy(&passes);
+        return_value = success ? 0 : CLI_ERROR;
+        if (executable) {
+            return_value = exec_program(executable, output_file);
+            free(executable);
+        }
+        free(default_cache_dir);
     }
 
     CLI_DEINIT();
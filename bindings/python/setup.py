@@ -8,6 +8,8 @@ bf2c_lib_dir = os.environ.get("BF2C_LIB_DIR", "")
 core_include_dir = os.environ.get("CORE_INCLUDE_DIR", "")
 core_lib_dir = os.environ.get("CORE_LIB_DIR", "")
 bf2c_version = os.environ.get("BF2C_VERSION", "")
+# set by CMake, whose Threads check decides whether bf2c_lib uses pthreads
+bf2c_have_pthreads = os.environ.get("BF2C_HAVE_PTHREADS", "0") == "1"
 
 ext_modules = [
     Extension(
@@ -15,7 +17,9 @@ ext_modules = [
         sources=["src/bf2c/py_bf2c.c"],
         include_dirs=[bf2c_include_dir, core_include_dir],
         library_dirs=[bf2c_lib_dir, core_lib_dir],
-        libraries=["bf2c_lib", "core"],
+        # the public headers use the basic vector types, which CMake enables for targets of core
+        define_macros=[("CORE_VECTOR_DECLARE_BASIC_TYPES", None)],
+        libraries=["bf2c_lib", "core"] + (["pthread"] if bf2c_have_pthreads else []),
         extra_compile_args=["-O3", "-std=c99"],
     )
 ]
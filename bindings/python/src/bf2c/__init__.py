@@ -1,6 +1,6 @@
 from pathlib import Path
 
-from .py_bf2c import parse_file, parse_text, print_code, emit_to_file
+from .py_bf2c import parse_file, parse_text, load_ir, save_ir, print_code, emit_to_file
 
 __ALL__ = ["BF2C"]
 
@@ -12,7 +12,11 @@ class BF2C:
         elif isinstance(code, Path):
             if not code.exists():
                 raise FileNotFoundError(f"No such file: '{code}'")
-            self._rep = parse_file(str(code))
+            # binary IR files are mapped instead of parsed, the pages are shared between processes
+            if code.suffix == ".bfir":
+                self._rep = load_ir(str(code))
+            else:
+                self._rep = parse_file(str(code))
         else:
             raise TypeError("code must be a str or Path")
 
@@ -23,3 +27,8 @@ class BF2C:
         if isinstance(file_path, Path):
             file_path = str(file_path)
         emit_to_file(self._rep, file_path)
+
+    def save_ir(self, file_path: str | Path) -> None:
+        if isinstance(file_path, Path):
+            file_path = str(file_path)
+        save_ir(self._rep, file_path)
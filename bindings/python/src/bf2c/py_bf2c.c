@@ -1,5 +1,6 @@
 #include <Python.h>
 
+#include "bf2c/bfir.h"
 #include "bf2c/c_emitter.h"
 #include "bf2c/parser.h"
 
@@ -54,13 +55,44 @@ static PyObject* parse_text(PyObject* self, PyObject* args) {
     return (PyObject*) Program_new(bf2c_parse_text(text));
 }
 
+static PyObject* load_ir(PyObject* self, PyObject* args) {
+    char const* file_path;
+    if (!PyArg_ParseTuple(args, "s", &file_path)) {
+        return NULL;
+    }
+    // the programs of the bindings are emitted with the default options
+    bf2c_options_t const options = bf2c_options_default();
+    program_t program;
+    if (!bf2c_bfir_load_from_filename(file_path, &options, &program)) {
+        PyErr_Format(PyExc_ValueError, "Failed to load IR file: '%s'", file_path);
+        return NULL;
+    }
+    return (PyObject*) Program_new(program);
+}
+
+static PyObject* save_ir(PyObject* self, PyObject* args) {
+    char const* file_path;
+    PyObject* program_obj;
+    if (!PyArg_ParseTuple(args, "O!s", &ProgramType, &program_obj, &file_path)) {
+        return NULL;
+    }
+    py_program_t* program        = (py_program_t*) program_obj;
+    bf2c_options_t const options = bf2c_options_default();
+    if (!bf2c_bfir_write_to_filename(file_path, &program->program, &options)) {
+        PyErr_Format(PyExc_OSError, "Failed to write IR file: '%s'", file_path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
 static PyObject* print_code(PyObject* self, PyObject* args) {
     PyObject* program_obj;
     if (!PyArg_ParseTuple(args, "O!", &ProgramType, &program_obj)) {
         return NULL;
     }
-    py_program_t* program = (py_program_t*) program_obj;
-    bf2c_emit_c_to_file(stdout, &program->program);
+    py_program_t* program        = (py_program_t*) program_obj;
+    bf2c_options_t const options = bf2c_options_default();
+    bf2c_emit_c_to_file(stdout, &program->program, &options);
     Py_RETURN_NONE;
 }
 
@@ -70,8 +102,9 @@ static PyObject* emit_to_file(PyObject* self, PyObject* args) {
     if (!PyArg_ParseTuple(args, "O!s", &ProgramType, &program_obj, &file_path)) {
         return NULL;
     }
-    py_program_t* program = (py_program_t*) program_obj;
-    bf2c_emit_c_to_filename(file_path, &program->program);
+    py_program_t* program        = (py_program_t*) program_obj;
+    bf2c_options_t const options = bf2c_options_default();
+    bf2c_emit_c_to_filename(file_path, &program->program, &options);
     Py_RETURN_NONE;
 }
 
@@ -84,6 +117,14 @@ static PyMethodDef bf2cMethods[] = {
      .ml_meth  = parse_text,
      .ml_flags = METH_VARARGS,
      .ml_doc   = "Parse Brainfuck code and return an internal representation."},
+    {.ml_name  = "load_ir",
+     .ml_meth  = load_ir,
+     .ml_flags = METH_VARARGS,
+     .ml_doc   = "Load an internal representation from a binary IR (.bfir) file."},
+    {.ml_name  = "save_ir",
+     .ml_meth  = save_ir,
+     .ml_flags = METH_VARARGS,
+     .ml_doc   = "Save an internal representation to a binary IR (.bfir) file."},
     {.ml_name  = "print_code",
      .ml_meth  = print_code,
      .ml_flags = METH_VARARGS,
@@ -0,0 +1,44 @@
+#ifndef BF2C_BFIR_H_
+#define BF2C_BFIR_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bf2c/options.h"
+#include "bf2c/program.h"
+
+// Binary serialized IR (.bfir)
+//
+// A versioned and checksummed image of a program_t, so a program can be parsed (and optimized) once
+// and emitted many times. The file holds a header followed by the command arrays as they are laid
+// out in memory, so loading maps the file and uses the arrays in place without decoding them.
+// The format uses the byte order of the producing machine, other byte orders are rejected.
+// The version changes with the set of commands, as their types are stored as they are.
+// The state of partially evaluated programs follows the commands.
+// The passes calculate with the cell width (e.g. the factors of multiplication loops), so the file
+// records the width of the options and is only loaded with the same one.
+enum { BFIR_VERSION = 7 };
+
+#define BFIR_EXTENSION ".bfir"
+
+// Whether the filename ends with BFIR_EXTENSION (the file is not opened, it may be a pipe).
+bool bf2c_bfir_has_extension(char const* filename);
+
+// TODO: return a RESULT for more precise error handling instead of bool
+// The options are those the program was optimized with.
+bool bf2c_bfir_write_to_file(FILE* file, program_t const* program, bf2c_options_t const* options);
+bool bf2c_bfir_write_to_filename(char const* filename,
+                                 program_t const* program,
+                                 bf2c_options_t const* options);
+
+// Load a program written by bf2c_bfir_write_to_*. Logs the reason and returns false if the file
+// cannot be read, is no .bfir file, has a different version or byte order, was written for another
+// cell width than that of the options, is corrupted or holds invalid commands (unknown types, loop
+// deltas not leading to the matching command).
+// Where supported, the commands are borrowed from a copy-on-write mapping of the file, which is
+// released by bf2c_program_destroy.
+bool bf2c_bfir_load_from_filename(char const* filename,
+                                  bf2c_options_t const* options,
+                                  program_t* program);
+
+#endif /* ifndef BF2C_BFIR_H_ */
@@ -4,10 +4,40 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "bf2c/options.h"
 #include "bf2c/program.h"
+#include "core/vector.h"
+
+// The C source is formatted into one growable buffer, which is written to files in large blocks.
+// The tape size, the cell type and whether the tape is mapped are taken from the options.
 
 // TODO: return a RESULT for more precise error handling instead of bool
-bool bf2c_emit_c_to_file(FILE* file, program_t const* program);
-bool bf2c_emit_c_to_filename(char const* filename, program_t const* program);
+bool bf2c_emit_c_to_file(FILE* file, program_t const* program, bf2c_options_t const* options);
+bool bf2c_emit_c_to_filename(char const* filename,
+                             program_t const* program,
+                             bf2c_options_t const* options);
+// Append the C source to the buffer, e.g. to pass it on without a temporary file.
+// Fails if the evaluated state of the program does not fit on the tape.
+bool bf2c_emit_c_to_buffer(core_vec_char_t* buffer,
+                           program_t const* program,
+                           bf2c_options_t const* options);
+
+// Streaming emitter.
+// Writes the C program piecewise, e.g. while the program is still being parsed from a pipe.
+// The emitted fragments must consist of complete statements (see bf2c_parser_take_completed).
+typedef struct bf2c_emitter_t {
+    FILE* file;
+    int indentation_level;
+    bool uses_debug; // the helper functions are only defined (after main) if they are used
+    bool uses_scan;
+    core_vec_char_t buffer; // reused for every fragment
+    bf2c_options_t options;
+} bf2c_emitter_t;
+
+bool bf2c_emitter_begin(bf2c_emitter_t* emitter, FILE* file, bf2c_options_t const* options);
+bool bf2c_emitter_emit(bf2c_emitter_t* emitter, program_t const* fragment);
+bool bf2c_emitter_end(bf2c_emitter_t* emitter);
+// Release the buffer, also after a failed begin, emit or end.
+void bf2c_emitter_destroy(bf2c_emitter_t* emitter);
 
 #endif /* ifndef BF2C_C_EMITTER_H_ */
@@ -0,0 +1,61 @@
+#ifndef BF2C_CACHE_H_
+#define BF2C_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bf2c/options.h"
+#include "bf2c/program.h"
+
+// Content-addressed on-disk cache of programs.
+// Entries are .bfir files named after a hash of the source, so a hit is loaded by mapping the file
+// without parsing. Executables compiled from programs (see bf2c/exec.h) are stored alongside,
+// named after a hash of the program. Once the directory exceeds its size limit, the least recently
+// used entries of both kinds are evicted (where the platform allows to list directories and update
+// modification times).
+typedef struct bf2c_cache_t {
+    char const* directory;
+    uint64_t max_size; // in bytes
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} bf2c_cache_t;
+
+typedef struct bf2c_cache_key_t {
+    uint64_t hash;
+    uint64_t size;
+} bf2c_cache_key_t;
+
+// Creates the directory and its parents if they do not exist yet.
+bf2c_cache_t bf2c_cache_create(char const* directory, uint64_t max_size);
+// The salt has to capture everything else the cached program depends on, e.g. the version of the
+// transpiler and its options.
+bf2c_cache_key_t bf2c_cache_key(char const* source, size_t size, char const* salt);
+// Key of the program itself, i.e. of its commands and state, e.g. for the executables.
+bf2c_cache_key_t bf2c_cache_program_key(program_t const* program, char const* salt);
+// Returns false on a miss. Broken entries are removed and count as a miss. The options are those
+// the program was optimized with (see bf2c/bfir.h).
+bool bf2c_cache_load(bf2c_cache_t* cache,
+                     bf2c_cache_key_t key,
+                     bf2c_options_t const* options,
+                     program_t* program);
+// Store the program and evict old entries, if the size limit is exceeded.
+bool bf2c_cache_store(bf2c_cache_t* cache,
+                      bf2c_cache_key_t key,
+                      bf2c_options_t const* options,
+                      program_t const* program);
+// Returns the path of the executable of the key (to be freed by the caller) or NULL on a miss.
+char* bf2c_cache_load_executable(bf2c_cache_t* cache, bf2c_cache_key_t key);
+// Builds an executable at the given (temporary) path, returns false on failure.
+typedef bool (*bf2c_cache_build_t)(char const* path, void* context);
+// Build the executable of the key, store it and evict old entries, if the size limit is exceeded.
+// Returns the path of the stored executable (to be freed by the caller) or NULL on failure.
+char* bf2c_cache_store_executable(bf2c_cache_t* cache,
+                                  bf2c_cache_key_t key,
+                                  bf2c_cache_build_t build,
+                                  void* context);
+// Log the hit/miss statistics in verbose mode.
+void bf2c_cache_log_stats(bf2c_cache_t const* cache);
+
+#endif /* ifndef BF2C_CACHE_H_ */
@@ -1,6 +1,8 @@
 #ifndef BF2C_COMMAND_H_
 #define BF2C_COMMAND_H_
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "bf2c/token.h"
@@ -14,18 +16,94 @@ typedef enum command_type_t {
     COMMAND_TYPE_LOOP_START,
     COMMAND_TYPE_LOOP_END,
     COMMAND_TYPE_DEBUG,
+    COMMAND_TYPE_SET, // only created by passes, e.g. for clear loops
+    COMMAND_TYPE_MUL, // data[idx + offset] += value * data[idx], created by passes
+    COMMAND_TYPE_SCAN, // move idx by value until data[idx] is zero, created by passes
+    COMMAND_TYPE_WRITE, // output the byte value, known at transpile time, created by passes
     COMMAND_TYPE_UNKNOWN,
 } command_type_t;
 
 typedef struct command_t {
     int32_t value;
     command_type_t type;
+    int32_t offset; // of the cell the command applies to, relative to idx
 } command_t;
 
+// Loop deltas which do not fit into command_t.value (only possible with more than 2^31 commands)
+// are stored out of line, so the common case keeps the compact command. The loop commands hold
+// COMMAND_VALUE_WIDE instead, see bf2c_program_loop_delta.
+#define COMMAND_VALUE_WIDE INT32_MIN
+
+typedef struct command_wide_value_t {
+    size_t index;
+    int64_t value;
+} command_wide_value_t;
+
 command_type_t bf2c_command_from_token(token_type_t token);
+// Whether consecutive commands of this type can be merged by adding their values.
+static inline bool bf2c_command_is_additive(command_type_t type) {
+    return type == COMMAND_TYPE_CHANGE_VAL || type == COMMAND_TYPE_CHANGE_PTR;
+}
 int32_t bf2c_command_value(token_type_t token);
 char const* bf2c_command_type_to_string(command_type_t type);
 
-VECTOR_DECLARE_WITH_PREFIX(command_vec_t, command_vec, command_t, void)
+// Commands are stored as a structure of arrays: the opcodes in a byte array and the operands in a
+// separate array. Scans for command types only touch one byte per command.
+typedef struct command_vec_t {
+    uint8_t* types; // command_type_t
+    int32_t* values;
+    int32_t* offsets; // NULL as long as all offsets are zero, e.g. for parsed programs
+    size_t size;
+    size_t capacity;
+    bool is_borrowed; // the arrays are owned elsewhere (e.g. a mapped file), copied on growth
+} command_vec_t;
+
+#define COMMAND_VEC_FOR_EACH(elem, vector)                                                         \
+    INTERNAL_VECTOR_FOR_EACH_SETUP(elem, vector)                                                   \
+    for (command_t elem = command_vec_at(&(vector), elem##_iterator); keep; keep = !keep)
+
+command_vec_t command_vec_create(void);
+command_vec_t command_vec_with_capacity(size_t capacity);
+// Copy the commands [begin, end) of `vector`.
+command_vec_t command_vec_from_range(command_vec_t const* vector, size_t begin, size_t end);
+void command_vec_destroy(command_vec_t* vector);
+bool command_vec_is_empty(command_vec_t const* vector);
+bool command_vec_contains(command_vec_t const* vector, command_type_t type);
+size_t command_vec_count(command_vec_t const* vector, command_type_t type);
+void command_vec_reserve(command_vec_t* vector, size_t new_capacity);
+void command_vec_shrink_to_fit(command_vec_t* vector);
+void command_vec_push_back(command_vec_t* vector, command_t command);
+// Remove the first `count` commands.
+void command_vec_erase_front(command_vec_t* vector, size_t count);
+
+// Allocate the (zeroed) offsets, called by command_vec_set for the first non-zero offset.
+void command_vec_enable_offsets(command_vec_t* vector);
+
+static inline command_t command_vec_at(command_vec_t const* vector, size_t index) {
+    return (command_t){vector->values[index],
+                       (command_type_t) vector->types[index],
+                       vector->offsets ? vector->offsets[index] : 0};
+}
+
+static inline void command_vec_set(command_vec_t* vector, size_t index, command_t command) {
+    vector->types[index]  = (uint8_t) command.type;
+    vector->values[index] = command.value;
+    if (command.offset != 0 && !vector->offsets) {
+        command_vec_enable_offsets(vector);
+    }
+    if (vector->offsets) {
+        vector->offsets[index] = command.offset;
+    }
+}
+
+VECTOR_DECLARE_WITH_PREFIX(command_wide_vec_t, command_wide_vec, command_wide_value_t, void)
+
+// Store the distance between the matching loop commands at `start` and `end` in both of them.
+// Distances which do not fit are added to `wide_deltas` (unsorted).
+void command_vec_link_loop(command_vec_t* vector,
+                           command_wide_vec_t* wide_deltas,
+                           size_t start,
+                           size_t end);
+void command_wide_vec_sort(command_wide_vec_t* vector);
 
 #endif /* ifndef BF2C_COMMAND_H_ */
@@ -0,0 +1,55 @@
+#ifndef BF2C_EXEC_H_
+#define BF2C_EXEC_H_
+
+#include <stdbool.h>
+
+#include "bf2c/cache.h"
+#include "bf2c/options.h"
+#include "bf2c/program.h"
+
+// Compile-and-run driver
+// Emits a program as C, builds it with the system C compiler and runs the executable. Executables
+// are cached (see bf2c/cache.h) by a hash of the program, the options of the emitted code, the
+// compiler command and its flags, so repeated runs of a program skip the compiler. The version of
+// the compiler behind the command is not part of the key.
+
+// Used when CC is not set
+#ifdef _WIN32
+#define BF2C_DEFAULT_CC "gcc"
+#else
+#define BF2C_DEFAULT_CC "cc"
+#endif
+// The emitted code is one large function of simple loops, -O3 mostly adds compile time.
+// No -march=native: the key only holds the flags, not the CPU they resolve to, and the cache
+// directory may be shared between hosts (e.g. a network home directory).
+#define BF2C_DEFAULT_CFLAGS "-O2"
+
+typedef struct bf2c_compiler_t {
+    char const* command; // run by the shell, e.g. "ccache gcc"
+    char const* flags;
+} bf2c_compiler_t;
+
+// The compiler of the CC environment variable or BF2C_DEFAULT_CC, with BF2C_DEFAULT_CFLAGS.
+bf2c_compiler_t bf2c_compiler_default(void);
+// Default directory of the cache: $XDG_CACHE_HOME/bf2c, ~/.cache/bf2c or %LOCALAPPDATA%\bf2c.
+// Returns NULL if none of them is known, otherwise a path to be freed by the caller.
+char* bf2c_exec_cache_directory(void);
+// Emit the program and compile it to the executable. The C file is removed afterwards.
+bool bf2c_exec_compile(program_t const* program,
+                       bf2c_options_t const* options,
+                       bf2c_compiler_t compiler,
+                       char const* executable);
+// Look the executable of the program up in the cache or compile and store it. The salt has to
+// describe everything else the program depends on (see bf2c_cache_key). Returns the path of the
+// executable (to be freed by the caller) or NULL on failure.
+char* bf2c_exec_build(bf2c_cache_t* cache,
+                      program_t const* program,
+                      bf2c_options_t const* options,
+                      bf2c_compiler_t compiler,
+                      char const* salt);
+// Run the executable with the standard streams of this process. Where the platform allows, the
+// process is replaced and this only returns on failure. Otherwise, the exit status of the
+// executable is stored in `status`. Returns false if the executable could not be started.
+bool bf2c_exec_run(char const* executable, int* status);
+
+#endif /* ifndef BF2C_EXEC_H_ */
@@ -0,0 +1,48 @@
+#ifndef BF2C_INTERPRETER_H_
+#define BF2C_INTERPRETER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "bf2c/options.h"
+#include "bf2c/program.h"
+#include "core/vector.h"
+
+// Interpreter
+// Runs a program in process, without a C compiler. The commands are translated to threaded code
+// (computed gotos where the compiler supports them), loops jump by the deltas stored in the
+// commands. Frequent sequences of commands are dispatched once as superinstructions (see
+// src/superinstructions.def). The program behaves like the emitted C program with the same
+// options: its state is the starting point, the cells wrap around modulo the cell width and the
+// input leaves the cell unchanged at its end.
+// With BF2C_ENGINE_TIERED, the back-edges of each loop are counted and a loop that runs often is
+// compiled by the JIT (see bf2c/jit.h), which takes over at the head of the loop.
+
+// Input and output of an executed program, both buffered by the interpreter.
+// `read` fills up to `size` bytes and returns their number, 0 at the end of the input.
+// `write` returns false on failure, which stops the program.
+typedef struct bf2c_io_t {
+    size_t (*read)(void* context, char* buffer, size_t size);
+    void* read_context;
+    bool (*write)(void* context, char const* data, size_t size);
+    void* write_context;
+} bf2c_io_t;
+
+// Read blocks from `input` (see bf2c_source_read_block) and write (and flush) to `output`.
+bf2c_io_t bf2c_io_from_files(FILE* input, FILE* output);
+
+// Input from and output into memory.
+typedef struct bf2c_io_memory_t {
+    char const* input; // advanced while it is read
+    size_t input_size;
+    core_vec_char_t output; // appended to
+} bf2c_io_memory_t;
+
+bf2c_io_t bf2c_io_from_memory(bf2c_io_memory_t* memory);
+
+// Run the program to its end. Logs the reason and returns false if the options are invalid, the
+// pointer leaves the tape or the output fails.
+bool bf2c_execute(program_t const* program, bf2c_options_t const* options, bf2c_io_t io);
+
+#endif /* ifndef BF2C_INTERPRETER_H_ */
@@ -0,0 +1,57 @@
+#ifndef BF2C_JIT_H_
+#define BF2C_JIT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bf2c/options.h"
+#include "bf2c/program.h"
+
+// JIT compiler
+// Lowers commands directly to x86-64 machine code (System V calling convention), which is written
+// to a buffer and then mapped executable, never writable and executable at once. The code works on
+// the tape of the interpreter (see bf2c/interpreter.h), cells of uint32_t whose upper bits are
+// zero. The cells are updated with instructions of the cell width, e.g. byte additions for 8-bit
+// cells, so they wrap around without masking. The pointer to the current cell is kept in a
+// register and is bounds-checked when it moves. Loops are relative jumps between the loop commands.
+// I/O calls back into the caller.
+// bf2c_execute uses it for the whole program with BF2C_ENGINE_JIT and for hot loops with
+// BF2C_ENGINE_TIERED, other platforms fall back to the interpreter.
+
+typedef enum bf2c_jit_status_t {
+    BF2C_JIT_DONE,
+    BF2C_JIT_OUT_OF_TAPE,
+    BF2C_JIT_IO_ERROR,
+} bf2c_jit_status_t;
+
+// State passed to the code
+typedef struct bf2c_jit_context_t {
+    uint32_t* cell;  // current cell, updated when the code returns
+    uint32_t* begin; // of the tape
+    uint32_t* end;   // behind the tape, cells at an offset from `cell` may lie outside of the tape
+    void* io;        // passed to the callbacks, which return false to stop the code
+    bool (*put)(void* io, uint32_t value);
+    bool (*get)(void* io, uint32_t* cell);
+    bool (*debug)(void* io, uint32_t const* cell);
+    size_t command; // index of the command which left the tape, set with BF2C_JIT_OUT_OF_TAPE
+} bf2c_jit_context_t;
+
+typedef struct bf2c_jit_code_t {
+    void* memory;
+    size_t size;
+} bf2c_jit_code_t;
+
+// Whether the JIT supports this platform.
+bool bf2c_jit_is_supported(void);
+// Compile the commands [begin, end) of the program, which have to contain complete loops.
+// Returns false if the platform is not supported or the offsets or the code are too large.
+bool bf2c_jit_compile(program_t const* program,
+                      size_t begin,
+                      size_t end,
+                      bf2c_options_t const* options,
+                      bf2c_jit_code_t* code);
+bf2c_jit_status_t bf2c_jit_run(bf2c_jit_code_t const* code, bf2c_jit_context_t* context);
+void bf2c_jit_destroy(bf2c_jit_code_t* code);
+
+#endif /* ifndef BF2C_JIT_H_ */
@@ -0,0 +1,38 @@
+#ifndef BF2C_OPTIONS_H_
+#define BF2C_OPTIONS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Default number of commands run at transpile time (see bf2c_options_t), a few milliseconds, enough
+// for most programs computing constants up front
+enum { BF2C_EVAL_STEPS = 10000000 };
+
+// How bf2c_execute runs programs (see bf2c/interpreter.h)
+typedef enum bf2c_engine_t {
+    BF2C_ENGINE_INTERPRETER,
+    BF2C_ENGINE_JIT, // falls back to the interpreter where the JIT is not supported
+    BF2C_ENGINE_TIERED, // interprets and compiles hot loops, interprets only without the JIT
+} bf2c_engine_t;
+
+// Options of the transformations, passed to every pass (see bf2c/pass.h), and of the emitted or
+// executed program (see bf2c/c_emitter.h and bf2c/interpreter.h). Both have to agree, as the
+// passes calculate with the cell width.
+typedef struct bf2c_options_t {
+    uint64_t eval_steps; // commands run at transpile time by partial evaluation, 0 disables it
+    size_t tape_size;    // number of cells
+    unsigned cell_bits;  // width of a cell, 8, 16 or 32, the cells wrap around modulo 2^cell_bits
+    bool mmap_tape;      // map the tape between guard pages instead of declaring it on the stack
+    bf2c_engine_t engine;
+} bf2c_options_t;
+
+bf2c_options_t bf2c_options_default(void);
+// Whether the tape size and the cell width are supported.
+bool bf2c_options_are_valid(bf2c_options_t const* options);
+// Mask of the bits of a cell, e.g. 0xff for 8-bit cells.
+uint32_t bf2c_options_cell_mask(bf2c_options_t const* options);
+// Parse "interpreter", "jit" or "tiered" into the engine. Returns false for other names.
+bool bf2c_engine_from_string(char const* name, bf2c_engine_t* engine);
+
+#endif /* ifndef BF2C_OPTIONS_H_ */
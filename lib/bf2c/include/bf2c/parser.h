@@ -1,13 +1,50 @@
 #ifndef BF2C_PARSER_H_
 #define BF2C_PARSER_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include "bf2c/command.h"
 #include "bf2c/program.h"
+#include "core/vector.h"
+
+// Incremental (push-style) parser.
+// The source can be fed in chunks of arbitrary size. Pending runs of "additive" commands and the
+// open loops are carried across chunk boundaries, so the chunks may split the source anywhere.
+typedef struct bf2c_parser_t {
+    command_vec_t commands;         // parsed commands which have not been taken yet
+    command_wide_vec_t wide_deltas; // loop deltas not fitting into the commands (unsorted)
+    core_vec_size_t open_loops;     // indices of the not yet closed LOOP_START commands
+    size_t taken;                   // number of commands already taken (for error messages)
+    command_type_t run_type;        // type of the pending run, only valid if has_run is set
+    int64_t run_value;              // may exceed a single command, it is split when flushed
+    bool has_run;
+} bf2c_parser_t;
+
+bf2c_parser_t bf2c_parser_create(void);
+void bf2c_parser_destroy(bf2c_parser_t* parser);
+void bf2c_parser_feed(bf2c_parser_t* parser, char const* source, size_t size);
+// Move the commands which form complete top-level statements out of the parser, i.e. everything
+// before the outermost open loop. The pending run is kept, as it may continue in the next chunk.
+// Taking them regularly keeps the memory of the parser bounded by the largest top-level loop.
+program_t bf2c_parser_take_completed(bf2c_parser_t* parser);
+// Flush the pending run and return all remaining commands. Destroys the parser.
+program_t bf2c_parser_finish(bf2c_parser_t* parser);
 
 // program_t* bf2c_parse_file(FILE* file); OR a RESULT
 program_t bf2c_parse_file(FILE* file);
 program_t bf2c_parse_file_by_name(char const* filename);
 program_t bf2c_parse_text(char const* text);
+program_t bf2c_parse_buffer(char const* source, size_t size);
+
+// Opt-in parallel parsing for very large sources.
+// The source is split into `num_threads` chunks which are tokenized and coalesced concurrently.
+// Runs are stitched at the chunk boundaries and loops are matched across the chunks afterwards,
+// so the result is identical to the sequential parser.
+program_t bf2c_parse_buffer_parallel(char const* source, size_t size, size_t num_threads);
+// Only regular files are split (at most one thread per MiB), other files are parsed sequentially.
+program_t bf2c_parse_file_by_name_parallel(char const* filename, size_t num_threads);
 
 #endif /* ifndef BF2C_PARSER_H_ */
@@ -0,0 +1,96 @@
+#ifndef BF2C_PASS_H_
+#define BF2C_PASS_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "bf2c/options.h"
+#include "bf2c/program.h"
+#include "core/vector.h"
+
+// Pass manager
+// Runs named transformation passes over a complete program in order and records the time and the
+// number of commands and loops before and after every pass.
+// The optimization levels select the passes like the -O levels of a C compiler:
+//   0: none, the commands are emitted as parsed
+//   1: passes replacing single loops (clear and scan loops) and removing dead code
+//   2: additionally multiplication loops, deferred pointer movements and known outputs
+//   3: additionally partial evaluation of the program prefix at transpile time
+enum { BF2C_OPT_LEVEL_MAX = 3, BF2C_OPT_LEVEL_DEFAULT = 3 };
+
+typedef void (*bf2c_pass_func_t)(program_t* program, bf2c_options_t const* options);
+
+typedef struct bf2c_pass_t {
+    char const* name;
+    bf2c_pass_func_t run;
+} bf2c_pass_t;
+
+typedef struct bf2c_pass_stats_t {
+    char const* name;
+    size_t commands_before;
+    size_t commands_after;
+    size_t loops_before;
+    size_t loops_after;
+    double seconds; // processor time
+} bf2c_pass_stats_t;
+
+VECTOR_DECLARE_WITH_PREFIX(bf2c_pass_vec_t, bf2c_pass_vec, bf2c_pass_t, void)
+VECTOR_DECLARE_WITH_PREFIX(bf2c_pass_stats_vec_t, bf2c_pass_stats_vec, bf2c_pass_stats_t, void)
+
+typedef struct bf2c_pass_manager_t {
+    bf2c_options_t options; // passed to every pass
+    bf2c_pass_vec_t passes;
+    bf2c_pass_stats_vec_t stats; // one per pass, summed over all runs
+} bf2c_pass_manager_t;
+
+bf2c_pass_manager_t bf2c_pass_manager_create(bf2c_options_t options);
+void bf2c_pass_manager_destroy(bf2c_pass_manager_t* manager);
+void bf2c_pass_manager_add(bf2c_pass_manager_t* manager, bf2c_pass_t pass);
+// Add the passes of the optimization level in order, levels above BF2C_OPT_LEVEL_MAX are clamped.
+void bf2c_pass_manager_add_level(bf2c_pass_manager_t* manager, int level);
+// Add the passes of the optimization level which only look at single loops or basic blocks, so
+// they can run on the fragments of a program (see bf2c_parser_take_completed).
+void bf2c_pass_manager_add_fragment_level(bf2c_pass_manager_t* manager, int level);
+// Add the passes of BF2C_OPT_LEVEL_DEFAULT.
+void bf2c_pass_manager_add_defaults(bf2c_pass_manager_t* manager);
+void bf2c_pass_manager_add_fragment_defaults(bf2c_pass_manager_t* manager);
+// Run the passes, their statistics are added to those of previous runs (e.g. of other fragments).
+void bf2c_pass_manager_run(bf2c_pass_manager_t* manager, program_t* program);
+// Write the comma-separated pass names and the options (e.g. for cache keys), truncated to the
+// buffer like snprintf. Returns the length of the full description.
+size_t bf2c_pass_manager_describe(bf2c_pass_manager_t const* manager, char* buffer, size_t size);
+// Print a table of the statistics, one line per pass and the totals.
+void bf2c_pass_manager_print_stats(bf2c_pass_manager_t const* manager, FILE* file);
+
+// Passes
+
+// Remove loops which are never entered: those at the very start of the program and those directly
+// behind another loop, as the current cell is zero in both cases.
+// Clears, scans and multiplications with the zero cell are removed as well.
+void bf2c_pass_dead_loops(program_t* program, bf2c_options_t const* options);
+// Merge adjacent runs of the same "additive" command and drop runs which cancel out, e.g. when
+// other passes removed the commands between them.
+void bf2c_pass_combine_runs(program_t* program, bf2c_options_t const* options);
+// Replace clear loops (`[-]`, `[+]` or any other odd step, as cells wrap around) by setting the
+// cell to zero. A SET absorbs the changes of the cell directly before and after it, e.g. `+[-]++`
+// becomes a single SET of 2.
+void bf2c_pass_clear_loops(program_t* program, bf2c_options_t const* options);
+// Replace loops which only add multiples of the counter to other cells, e.g. `[->+>+++<<]`, by MUL
+// commands followed by clearing the counter. Counters may step by any odd value.
+void bf2c_pass_mul_loops(program_t* program, bf2c_options_t const* options);
+// Replace loops which only move the pointer, e.g. `[>]` or `[<<<<]`, by a SCAN for a zero cell.
+void bf2c_pass_scan_loops(program_t* program, bf2c_options_t const* options);
+// Defer pointer movements within basic blocks and address the cells by their offset instead, e.g.
+// `>++>+<<` becomes `data[idx + 1] += 2; data[idx + 2] += 1;`. idx is only updated in front of
+// loop boundaries, I/O, MUL and SCAN.
+void bf2c_pass_offsets(program_t* program, bf2c_options_t const* options);
+// Replace outputs of cells with a value known at transpile time (set by a SET, or zero behind a
+// loop) by WRITE commands and move them together, so that the emitter writes them at once.
+void bf2c_pass_known_output(program_t* program, bf2c_options_t const* options);
+// Run the program at transpile time for up to options->eval_steps commands, starting from its
+// state. The evaluation stops in front of input and debug commands, when the pointer leaves the
+// tape or when the steps are used up. Then it is reset to the last completed top-level command
+// and the program continues from there, with the resulting tape and output as its state.
+void bf2c_pass_partial_eval(program_t* program, bf2c_options_t const* options);
+
+#endif /* ifndef BF2C_PASS_H_ */
@@ -1,16 +1,42 @@
 #ifndef BF2C_PROGRAM_H_
 #define BF2C_PROGRAM_H_
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "bf2c/command.h"
+#include "bf2c/source.h"
+#include "core/vector.h"
+
+// Default number of cells of the tape (see bf2c_options_t)
+enum { BF2C_TAPE_SIZE = 30000 };
+
+// State in which the commands start, e.g. after running a part of the program at transpile time
+// (see bf2c_pass_partial_eval). Empty for parsed programs: a zeroed tape, idx 0 and no output.
+typedef struct program_state_t {
+    core_vec_int_t cells;   // values of the first cells, the other cells are zero
+    size_t index;           // value of idx
+    core_vec_char_t output; // written before the commands
+} program_state_t;
 
 typedef struct program_t {
     command_vec_t commands;
+    command_wide_vec_t wide_deltas; // loop deltas not fitting into the commands, sorted by index
+    bf2c_source_t mapping;          // backing mapping of borrowed commands (see bf2c/bfir.h)
+    program_state_t state;
 } program_t;
 
 program_t bf2c_program_create(command_vec_t commands);
 void bf2c_program_destroy(program_t* program);
+bool bf2c_program_has_state(program_t const* program);
 void bf2c_program_print(program_t const* program);
+// Signed distance from the loop command at `index` to its matching counterpart.
+int64_t bf2c_program_loop_delta(program_t const* program, size_t index);
+// Index of the command matching the loop command at `index`, i.e. the loop region is
+// [index, bf2c_program_loop_match(program, index)] for a LOOP_START.
+size_t bf2c_program_loop_match(program_t const* program, size_t index);
+// Recompute all loop deltas, e.g. after a pass inserted or removed commands.
+void bf2c_program_link_loops(program_t* program);
 
 #endif /* ifndef BF2C_PROGRAM_H_ */
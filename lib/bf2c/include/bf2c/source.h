@@ -0,0 +1,31 @@
+#ifndef BF2C_SOURCE_H_
+#define BF2C_SOURCE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Read-only view of a complete Brainfuck source in memory.
+// Regular files are memory-mapped (where supported), so they can be scanned in place.
+typedef struct bf2c_source_t {
+    char const* data;
+    size_t size;
+    bool is_mapped;
+} bf2c_source_t;
+
+// Map a regular file read-only.
+// Returns false if the file cannot be opened, is not a regular file (e.g. a pipe or terminal)
+// or the platform does not support mapping. The caller should fall back to streaming then.
+bool bf2c_source_map_file(bf2c_source_t* source, char const* filename);
+// Map a regular file copy-on-write. The pages are shared with the page cache (and thus with other
+// processes mapping the same file) until they are written to, writes never reach the file.
+bool bf2c_source_map_file_private(bf2c_source_t* source, char const* filename);
+void bf2c_source_unmap(bf2c_source_t* source);
+
+// Read the next block of up to `size` bytes from `file` into `buffer`.
+// Where available, this reads from the underlying file descriptor with read(2) and bypasses the
+// stdio buffer, i.e. the stream should not have been read through stdio before.
+// Returns the number of bytes read (0 on end of file) and sets `error` on failure.
+size_t bf2c_source_read_block(FILE* file, char* buffer, size_t size, bool* error);
+
+#endif /* ifndef BF2C_SOURCE_H_ */
@@ -1,6 +1,8 @@
 #ifndef BF2C_TOKEN_H_
 #define BF2C_TOKEN_H_
 
+#include <stddef.h>
+
 typedef enum token_type_t {
     TOKEN_PLUS,
     TOKEN_MINUS,
@@ -18,5 +20,11 @@ typedef enum token_type_t {
 token_type_t bf2c_token_from_char(char source);
 char bf2c_token_to_char(token_type_t token);
 
+// Classify `size` characters of `source` at once and write the token types of all non-comment
+// characters to `out`, which must have room for `size` tokens.
+// Returns the number of tokens written.
+// Uses SIMD (AVX2 or SSE2, selected at runtime) where available to skip comments in bulk.
+size_t bf2c_token_filter(char const* source, size_t size, token_type_t* out);
+
 
 #endif /* ifndef BF2C_TOKEN_H_ */
@@ -0,0 +1,437 @@
+#include "bf2c/bfir.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bf2c/command.h"
+#include "bf2c/options.h"
+#include "bf2c/program.h"
+#include "bf2c/source.h"
+#include "core/abort.h"
+#include "core/hash.h"
+#include "core/logging.h"
+#include "core/vector.h"
+
+enum {
+    // every section starts at a multiple of this, so the arrays can be used in place
+    BFIR_ALIGNMENT = 8,
+    // non-mappable files are read in blocks of this size
+    BFIR_READ_BLOCK_SIZE = 1 << 20
+};
+
+static char const BFIR_MAGIC[4]       = {'B', 'F', 'I', 'R'};
+static uint32_t const BFIR_BYTE_ORDER = 0x01020304;
+// the file contains the offsets of the commands (otherwise they are all zero)
+static uint32_t const BFIR_FLAG_OFFSETS = 1U << 0;
+
+// 72 bytes without padding between the members
+typedef struct bfir_header_t {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order; // BFIR_BYTE_ORDER in the byte order of the producer
+    uint32_t flags;
+    uint64_t num_commands;
+    uint64_t num_wide_deltas;
+    uint64_t checksum;        // core_hash64 chained over the sections (without padding)
+    uint64_t num_state_cells; // program_state_t, see bf2c_pass_partial_eval
+    uint64_t num_state_output;
+    uint64_t state_index;
+    uint32_t cell_bits; // of the options the program was optimized with
+    uint32_t reserved;
+} bfir_header_t;
+
+typedef struct bfir_wide_value_t {
+    uint64_t index;
+    int64_t value;
+} bfir_wide_value_t;
+
+// Offsets of the sections from the start of the file
+typedef struct bfir_layout_t {
+    size_t types;
+    size_t values;
+    size_t offsets;
+    size_t wide_deltas;
+    size_t state_cells;
+    size_t state_output;
+    size_t end;
+} bfir_layout_t;
+
+static size_t bfir_align(size_t offset) {
+    return (offset + BFIR_ALIGNMENT - 1) / BFIR_ALIGNMENT * BFIR_ALIGNMENT;
+}
+
+static bfir_layout_t bfir_layout(size_t num_commands,
+                                 size_t num_offsets,
+                                 size_t num_wide_deltas,
+                                 size_t num_state_cells,
+                                 size_t num_state_output) {
+    bfir_layout_t layout;
+    layout.types       = sizeof(bfir_header_t);
+    layout.values      = bfir_align(layout.types + num_commands * sizeof(uint8_t));
+    layout.offsets     = bfir_align(layout.values + num_commands * sizeof(int32_t));
+    layout.wide_deltas = bfir_align(layout.offsets + num_offsets * sizeof(int32_t));
+    layout.state_cells =
+        bfir_align(layout.wide_deltas + num_wide_deltas * sizeof(bfir_wide_value_t));
+    layout.state_output = bfir_align(layout.state_cells + num_state_cells * sizeof(int32_t));
+    layout.end          = bfir_align(layout.state_output + num_state_output * sizeof(char));
+    return layout;
+}
+
+static uint64_t bfir_checksum(uint8_t const* types,
+                              int32_t const* values,
+                              size_t num_commands,
+                              int32_t const* offsets,
+                              size_t num_offsets,
+                              bfir_wide_value_t const* wide_deltas,
+                              size_t num_wide_deltas,
+                              program_state_t const* state) {
+    uint64_t hash = core_hash64(types, num_commands * sizeof(uint8_t), BFIR_VERSION);
+    hash          = core_hash64(values, num_commands * sizeof(int32_t), hash);
+    hash          = core_hash64(offsets, num_offsets * sizeof(int32_t), hash);
+    hash = core_hash64(wide_deltas, num_wide_deltas * sizeof(bfir_wide_value_t), hash);
+    hash = core_hash64(state->cells.data, state->cells.size * sizeof(int32_t), hash);
+    hash = core_hash64(&state->index, sizeof(state->index), hash);
+    return core_hash64(state->output.data, state->output.size * sizeof(char), hash);
+}
+
+static bool bfir_write_padded(FILE* file, void const* data, size_t size) {
+    static char const zeros[BFIR_ALIGNMENT] = {0};
+    size_t const padding                    = bfir_align(size) - size;
+    return (size == 0 || fwrite(data, 1, size, file) == size) &&
+           (padding == 0 || fwrite(zeros, 1, padding, file) == padding);
+}
+
+bool bf2c_bfir_has_extension(char const* filename) {
+    ABORT_IF(!filename);
+    size_t const length     = strlen(filename);
+    size_t const ext_length = strlen(BFIR_EXTENSION);
+    return length > ext_length && strcmp(filename + length - ext_length, BFIR_EXTENSION) == 0;
+}
+
+bool bf2c_bfir_write_to_file(FILE* file, program_t const* program, bf2c_options_t const* options) {
+    ABORT_IF(!file || !program || !options);
+    command_vec_t const* commands = &program->commands;
+    size_t const num_offsets      = commands->offsets ? commands->size : 0;
+    size_t const num_wide_deltas  = program->wide_deltas.size;
+    bfir_wide_value_t* wide_deltas =
+        num_wide_deltas > 0 ? malloc(num_wide_deltas * sizeof(bfir_wide_value_t)) : NULL;
+    LOG_MSG_AND_ABORT_IF(num_wide_deltas > 0 && !wide_deltas, "Failed to allocate IR buffer.");
+    for (size_t i = 0; i < num_wide_deltas; ++i) {
+        wide_deltas[i] = (bfir_wide_value_t){program->wide_deltas.data[i].index,
+                                             program->wide_deltas.data[i].value};
+    }
+
+    bfir_header_t header = {0};
+    memcpy(header.magic, BFIR_MAGIC, sizeof(BFIR_MAGIC));
+    header.version          = BFIR_VERSION;
+    header.byte_order       = BFIR_BYTE_ORDER;
+    header.flags            = num_offsets > 0 ? BFIR_FLAG_OFFSETS : 0;
+    header.num_commands     = commands->size;
+    header.num_wide_deltas  = num_wide_deltas;
+    header.num_state_cells  = program->state.cells.size;
+    header.num_state_output = program->state.output.size;
+    header.state_index      = program->state.index;
+    header.cell_bits        = options->cell_bits;
+    header.checksum         = bfir_checksum(commands->types,
+                                            commands->values,
+                                            commands->size,
+                                            commands->offsets,
+                                            num_offsets,
+                                            wide_deltas,
+                                            num_wide_deltas,
+                                            &program->state);
+
+    bool const result =
+        fwrite(&header, sizeof(header), 1, file) == 1 &&
+        bfir_write_padded(file, commands->types, commands->size * sizeof(uint8_t)) &&
+        bfir_write_padded(file, commands->values, commands->size * sizeof(int32_t)) &&
+        bfir_write_padded(file, commands->offsets, num_offsets * sizeof(int32_t)) &&
+        bfir_write_padded(file, wide_deltas, num_wide_deltas * sizeof(bfir_wide_value_t)) &&
+        bfir_write_padded(
+            file, program->state.cells.data, program->state.cells.size * sizeof(int32_t)) &&
+        bfir_write_padded(file, program->state.output.data, program->state.output.size);
+    free(wide_deltas);
+    return result;
+}
+
+bool bf2c_bfir_write_to_filename(char const* filename,
+                                 program_t const* program,
+                                 bf2c_options_t const* options) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        return false;
+    }
+    bool const result = bf2c_bfir_write_to_file(file, program, options);
+    return fclose(file) == 0 && result;
+}
+
+// Fallback for platforms without mmap: read the whole file into memory.
+static bool bfir_read_file(bf2c_source_t* source, char const* filename) {
+    *source    = (bf2c_source_t){0};
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        return false;
+    }
+    char* data      = NULL;
+    size_t size     = 0;
+    size_t capacity = 0;
+    bool error      = false;
+    for (;;) {
+        if (capacity - size < BFIR_READ_BLOCK_SIZE) {
+            capacity        = capacity == 0 ? BFIR_READ_BLOCK_SIZE : 2 * capacity;
+            char* allocated = realloc(data, capacity);
+            LOG_MSG_AND_ABORT_IF(!allocated, "Failed to allocate IR buffer.");
+            data = allocated;
+        }
+        size_t const ret_val =
+            bf2c_source_read_block(file, data + size, BFIR_READ_BLOCK_SIZE, &error);
+        if (ret_val == 0) {
+            break;
+        }
+        size += ret_val;
+    }
+    (void) fclose(file);
+    if (error) {
+        free(data);
+        return false;
+    }
+    source->data = data;
+    source->size = size;
+    return true;
+}
+
+static void bfir_release(bf2c_source_t* source) {
+    if (source->is_mapped) {
+        bf2c_source_unmap(source);
+    } else {
+        free((void*) source->data);
+        *source = (bf2c_source_t){0};
+    }
+}
+
+// Delta stored for the loop command at `index`, see bf2c_program_loop_delta. Returns false if a
+// wide delta is missing.
+static bool bfir_loop_delta(int32_t const* values,
+                            bfir_wide_value_t const* wide_deltas,
+                            size_t num_wide_deltas,
+                            size_t index,
+                            int64_t* delta) {
+    if (values[index] != COMMAND_VALUE_WIDE) {
+        *delta = values[index];
+        return true;
+    }
+    size_t low  = 0;
+    size_t high = num_wide_deltas;
+    while (low < high) {
+        size_t const mid = low + (high - low) / 2;
+        if (wide_deltas[mid].index < index) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == num_wide_deltas || wide_deltas[low].index != index) {
+        return false;
+    }
+    *delta = wide_deltas[low].value;
+    return true;
+}
+
+// The checksum is no protection against crafted files, so the commands are checked before they are
+// trusted: the engines index tables by the type and jump by the loop deltas without bounds checks.
+static char const* bfir_validate_commands(uint8_t const* types,
+                                          int32_t const* values,
+                                          size_t num_commands,
+                                          bfir_wide_value_t const* wide_deltas,
+                                          size_t num_wide_deltas) {
+    for (size_t i = 0; i < num_wide_deltas; ++i) {
+        uint64_t const index = wide_deltas[i].index;
+        if (index >= num_commands || (i > 0 && index <= wide_deltas[i - 1].index)) {
+            return "invalid wide loop deltas";
+        }
+        bool const is_loop = types[index] == COMMAND_TYPE_LOOP_START ||
+                             types[index] == COMMAND_TYPE_LOOP_END;
+        if (!is_loop || values[index] != COMMAND_VALUE_WIDE) {
+            return "invalid wide loop deltas";
+        }
+    }
+    // re-match the loops, every delta has to lead to the matching command
+    char const* error          = NULL;
+    core_vec_size_t open_loops = core_vec_size_create();
+    for (size_t i = 0; i < num_commands && !error; ++i) {
+        if (types[i] > COMMAND_TYPE_UNKNOWN) {
+            error = "invalid command type";
+        } else if (types[i] == COMMAND_TYPE_LOOP_START) {
+            core_vec_size_push_back(&open_loops, i);
+        } else if (types[i] == COMMAND_TYPE_LOOP_END) {
+            if (core_vec_size_is_empty(&open_loops)) {
+                error = "unmatched loop end";
+                continue;
+            }
+            size_t const start     = core_vec_size_pop_back(&open_loops);
+            int64_t const expected = (int64_t) (i - start);
+            int64_t start_delta    = 0;
+            int64_t end_delta      = 0;
+            if (!bfir_loop_delta(values, wide_deltas, num_wide_deltas, start, &start_delta) ||
+                !bfir_loop_delta(values, wide_deltas, num_wide_deltas, i, &end_delta) ||
+                start_delta != expected || end_delta != -expected)
+            {
+                error = "invalid loop delta";
+            }
+        }
+    }
+    if (!error && !core_vec_size_is_empty(&open_loops)) {
+        error = "unmatched loop start";
+    }
+    core_vec_size_destroy(&open_loops);
+    return error;
+}
+
+static char const* bfir_validate(bf2c_source_t const* source,
+                                 bf2c_options_t const* options,
+                                 bfir_header_t* header_out,
+                                 bfir_layout_t* layout) {
+    bfir_header_t header;
+    if (source->size < sizeof(header)) {
+        return "file too small";
+    }
+    memcpy(&header, source->data, sizeof(header));
+    if (memcmp(header.magic, BFIR_MAGIC, sizeof(BFIR_MAGIC)) != 0) {
+        return "not a .bfir file";
+    }
+    // the byte order first, the other fields are unreadable with a different one
+    if (header.byte_order != BFIR_BYTE_ORDER) {
+        return "written with a different byte order";
+    }
+    if (header.version != BFIR_VERSION) {
+        return "unsupported version";
+    }
+    if ((header.flags & ~BFIR_FLAG_OFFSETS) != 0) {
+        return "unsupported flags";
+    }
+    if (header.cell_bits != options->cell_bits) {
+        return "optimized for a different cell width";
+    }
+    // bound the counts by the file size first, so computing the layout cannot overflow
+    if (header.num_commands > source->size || header.num_wide_deltas > source->size ||
+        header.num_state_cells > source->size || header.num_state_output > source->size) {
+        return "truncated";
+    }
+    size_t const num_offsets =
+        (header.flags & BFIR_FLAG_OFFSETS) != 0 ? (size_t) header.num_commands : 0;
+    *layout = bfir_layout((size_t) header.num_commands,
+                          num_offsets,
+                          (size_t) header.num_wide_deltas,
+                          (size_t) header.num_state_cells,
+                          (size_t) header.num_state_output);
+    if (layout->end != source->size) {
+        return "unexpected file size";
+    }
+    // The checksum catches corrupted files, the commands are validated below.
+    // The state sections are viewed in place, they are copied by the caller.
+    program_state_t const state = {
+        .cells  = {(int32_t*) (void*) (source->data + layout->state_cells),
+                   (size_t) header.num_state_cells,
+                   (size_t) header.num_state_cells},
+        .index  = (size_t) header.state_index,
+        .output = {(char*) (source->data + layout->state_output),
+                   (size_t) header.num_state_output,
+                   (size_t) header.num_state_output},
+    };
+    uint64_t const checksum =
+        bfir_checksum((uint8_t const*) (source->data + layout->types),
+                      (int32_t const*) (void const*) (source->data + layout->values),
+                      (size_t) header.num_commands,
+                      (int32_t const*) (void const*) (source->data + layout->offsets),
+                      num_offsets,
+                      (bfir_wide_value_t const*) (void const*) (source->data + layout->wide_deltas),
+                      (size_t) header.num_wide_deltas,
+                      &state);
+    if (checksum != header.checksum) {
+        return "checksum mismatch";
+    }
+    char const* error = bfir_validate_commands(
+        (uint8_t const*) (source->data + layout->types),
+        (int32_t const*) (void const*) (source->data + layout->values),
+        (size_t) header.num_commands,
+        (bfir_wide_value_t const*) (void const*) (source->data + layout->wide_deltas),
+        (size_t) header.num_wide_deltas);
+    if (error) {
+        return error;
+    }
+    *header_out = header;
+    return NULL;
+}
+
+bool bf2c_bfir_load_from_filename(char const* filename,
+                                  bf2c_options_t const* options,
+                                  program_t* program) {
+    ABORT_IF(!filename || !options || !program);
+    bf2c_source_t source;
+    if (!bf2c_source_map_file_private(&source, filename) && !bfir_read_file(&source, filename)) {
+        LOG_ERROR("Failed to read IR file: %s", filename);
+        return false;
+    }
+    bfir_header_t header;
+    bfir_layout_t layout;
+    char const* error = bfir_validate(&source, options, &header, &layout);
+    if (error) {
+        LOG_ERROR("Invalid IR file %s: %s", filename, error);
+        bfir_release(&source);
+        return false;
+    }
+
+    size_t const num_commands = (size_t) header.num_commands;
+    // The mapping is private and writable, so the arrays can be used (and modified) in place.
+    char* data             = (char*) source.data;
+    command_vec_t commands = {
+        .types       = (uint8_t*) (data + layout.types),
+        .values      = (int32_t*) (void*) (data + layout.values),
+        .offsets     = (header.flags & BFIR_FLAG_OFFSETS) != 0
+                           ? (int32_t*) (void*) (data + layout.offsets)
+                           : NULL,
+        .size        = num_commands,
+        .capacity    = num_commands,
+        .is_borrowed = true,
+    };
+    if (!source.is_mapped) {
+        // the buffer is freed below, take a copy
+        commands = command_vec_from_range(&commands, 0, num_commands);
+    }
+    *program = bf2c_program_create(commands);
+
+    // the (rare) wide deltas are converted, as size_t may be narrower than the stored index
+    bfir_wide_value_t const* wide_deltas =
+        (bfir_wide_value_t const*) (void const*) (data + layout.wide_deltas);
+    command_wide_vec_reserve(&program->wide_deltas, (size_t) header.num_wide_deltas);
+    for (size_t i = 0; i < (size_t) header.num_wide_deltas; ++i) {
+        command_wide_vec_push_back(
+            &program->wide_deltas,
+            (command_wide_value_t){(size_t) wide_deltas[i].index, wide_deltas[i].value});
+    }
+
+    // the state is small and owned by the program, so it is always copied
+    program->state.index = (size_t) header.state_index;
+    program->state.cells = core_vec_int_with_capacity((size_t) header.num_state_cells);
+    for (size_t i = 0; i < (size_t) header.num_state_cells; ++i) {
+        int32_t cell;
+        memcpy(&cell, data + layout.state_cells + i * sizeof(int32_t), sizeof(cell));
+        core_vec_int_push_back(&program->state.cells, cell);
+    }
+    program->state.output = core_vec_char_with_capacity((size_t) header.num_state_output);
+    for (size_t i = 0; i < (size_t) header.num_state_output; ++i) {
+        core_vec_char_push_back(&program->state.output, data[layout.state_output + i]);
+    }
+
+    if (source.is_mapped) {
+        program->mapping = source;
+    } else {
+        bfir_release(&source);
+    }
+    LOG_DEBUG("Loaded IR file: %s (%zu commands)", filename, num_commands);
+    return true;
+}
@@ -1,134 +1,718 @@
 #include "bf2c/c_emitter.h"
 
-#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
 #include "bf2c/command.h"
+#include "bf2c/options.h"
 #include "bf2c/program.h"
+#include "core/abort.h"
+#include "core/logging.h"
 #include "core/vector.h"
 
 enum {
     INDENT_WIDTH = 4,
-    // used to store the command string
-    // before writing it to the file
-    // (e.g. "data[idx] += 1;")
-    // 256 should be enough for most cases
-    BUFFER_SIZE = 256
+    // the buffer of a file is written once it holds this many bytes
+    FLUSH_SIZE = 1 << 20,
+    // space reserved for a statement without indentation,
+    // e.g. "data[idx - 2147483648] -= 2147483648 * data[idx];\n"
+    MAX_STATEMENT_SIZE = 64,
+    // of the longest integer, "-9223372036854775808"
+    MAX_INTEGER_SIZE = 20
 };
 
-#define DBG_SIZE_VAL  "31"
-#define DATA_SIZE_VAL "30000"
+#define DBG_SIZE_VAL "31"
 
-static char const* const INCLUDES = "#include <stdio.h>\n\n";
+// memrchr (see SCAN_FUNC) is a GNU extension, the feature macro has to precede all includes
+static char const* const SCAN_FEATURES = "#define _GNU_SOURCE\n";
+// for the scan and the cells wider than a byte
+static char const* const STDINT_INCLUDES = "#include <stdint.h>\n";
+static char const* const IO_INCLUDES   = "#include <stdio.h>\n";
+static char const* const STRING_INCLUDES = "#include <string.h>\n";
+// read(2) where available, so input arriving in pieces (e.g. from a terminal) is not waited for
+static char const* const INPUT_INCLUDES = "#if defined(__unix__) || defined(__APPLE__)\n"
+                                          "#include <unistd.h>\n"
+                                          "#define IN_READ 1\n"
+                                          "#endif\n";
+static char const* const TAPE_INCLUDES = "#include <stdlib.h>\n"
+                                         "#if defined(__unix__) || defined(__APPLE__)\n"
+                                         "#include <sys/mman.h>\n"
+                                         "#include <unistd.h>\n"
+                                         "#define TAPE_MMAP 1\n"
+                                         "#endif\n";
+// followed by the tape size and the cell type
 static char const* const PREAMBLE = "/* PREAMBLE */\n"
-                                    "#define DATA_SIZE " DATA_SIZE_VAL "\n";
+                                    "#define DATA_SIZE ";
+static char const* const DEBUG_DECL =
+    "\nvoid debug(cell_t const* data, unsigned int idx);\n";
 static char const* const DEBUG_FUNC =
     "#define DBG_SIZE " DBG_SIZE_VAL "\n\n"
-    "void debug(unsigned char const* data, unsigned int idx) {\n"
-    "    size_t const start = idx < DBG_SIZE / 2 ? 0\n"
+    "void debug(cell_t const* data, unsigned int idx) {\n"
+    "    out_flush();\n"
+    "    size_t const start = idx < DBG_SIZE / 2 || DATA_SIZE < DBG_SIZE ? 0\n"
     "                       : idx >= DATA_SIZE - DBG_SIZE / 2 ? DATA_SIZE - DBG_SIZE\n"
     "                       : idx - DBG_SIZE / 2;\n"
+    "    size_t const end   = start + DBG_SIZE < DATA_SIZE ? start + DBG_SIZE : DATA_SIZE;\n"
     "    printf(\"\\n\");\n"
-    "    for (size_t i = start; i < DBG_SIZE; ++i) {\n"
-    "        printf(\"[%3d]\", data[i]);\n"
+    "    for (size_t i = start; i < end; ++i) {\n"
+    "        printf(\"[%3lu]\", (unsigned long) data[i]);\n"
     "    }\n"
     "    printf(\"\\n\");\n"
     "}\n";
+static char const* const SCAN_DECL =
+    "unsigned int scan(cell_t const* data, unsigned int idx, int step);\n";
+// Search the next zero cell in steps of `step` cells (as the loop `while (data[idx]) idx += step;`)
+// with memchr/memrchr for single steps of byte cells. Small strides test a word of cells at once
+// (SWAR), the zero test is exact per cell, so there are no false positives from neighbouring cells.
+static char const* const SCAN_FUNC =
+    "\n#define SCAN_WORD 8\n\n"
+    "static uint64_t scan_mask(int first, int step) {\n"
+    "    unsigned char lanes[SCAN_WORD] = {0};\n"
+    "    for (int i = first; i >= 0 && i < SCAN_WORD; i += step) {\n"
+    "        lanes[i] = 0x80;\n"
+    "    }\n"
+    "    uint64_t mask;\n"
+    "    memcpy(&mask, lanes, sizeof(mask));\n"
+    "    return mask;\n"
+    "}\n\n"
+    "static int scan_has_zero(unsigned char const* cells, uint64_t mask) {\n"
+    "    uint64_t const low = 0x7f7f7f7f7f7f7f7fULL;\n"
+    "    uint64_t word;\n"
+    "    memcpy(&word, cells, sizeof(word));\n"
+    "    return (~(((word & low) + low) | word | low) & mask) != 0;\n"
+    "}\n\n"
+    "unsigned int scan(cell_t const* data, unsigned int idx, int step) {\n"
+    "    long pos = (long) idx;\n"
+    "    if (step == 1) {\n"
+    "        cell_t const* found = memchr(data + idx, 0, DATA_SIZE - idx);\n"
+    "        return found ? (unsigned int) (found - data) : DATA_SIZE;\n"
+    "    }\n"
+    "#ifdef __GLIBC__\n"
+    "    if (step == -1) {\n"
+    "        cell_t const* found = memrchr(data, 0, idx + 1);\n"
+    "        return found ? (unsigned int) (found - data) : (unsigned int) -1;\n"
+    "    }\n"
+    "#endif\n"
+    "    if (step > 1 && step < SCAN_WORD) {\n"
+    "        uint64_t const mask = scan_mask(0, step);\n"
+    "        long const stride   = (SCAN_WORD + step - 1) / step * step;\n"
+    "        while (pos + SCAN_WORD <= DATA_SIZE && !scan_has_zero(data + pos, mask)) {\n"
+    "            pos += stride;\n"
+    "        }\n"
+    "    } else if (step < -1 && step > -SCAN_WORD) {\n"
+    "        uint64_t const mask = scan_mask(SCAN_WORD - 1, step);\n"
+    "        long const stride   = (SCAN_WORD - step - 1) / -step * -step;\n"
+    "        while (pos >= SCAN_WORD - 1 &&\n"
+    "               !scan_has_zero(data + pos - (SCAN_WORD - 1), mask)) {\n"
+    "            pos -= stride;\n"
+    "        }\n"
+    "    }\n"
+    "    while (pos >= 0 && pos < DATA_SIZE && data[pos]) {\n"
+    "        pos += step;\n"
+    "    }\n"
+    "    return (unsigned int) pos;\n"
+    "}\n";
+// Wider cells are tested one by one.
+static char const* const SCAN_FUNC_WIDE =
+    "\nunsigned int scan(cell_t const* data, unsigned int idx, int step) {\n"
+    "    long pos = (long) idx;\n"
+    "    while (pos >= 0 && pos < DATA_SIZE && data[pos]) {\n"
+    "        pos += step;\n"
+    "    }\n"
+    "    return (unsigned int) pos;\n"
+    "}\n";
+// Buffered I/O
+// The output is collected in a large buffer, which is written when it is full, before reading
+// input and at the end (with OUT_FLUSH_LINES also at every newline). out_bytes writes a string of
+// at most OUT_SIZE bytes at once. The input is read in blocks of up to IN_SIZE bytes.
+static char const* const OUTPUT_FUNC =
+    "\n#define OUT_SIZE 65536\n"
+    "#ifndef OUT_FLUSH_LINES\n"
+    "#define OUT_FLUSH_LINES 0\n"
+    "#endif\n\n"
+    "static unsigned char out_buf[OUT_SIZE];\n"
+    "static size_t out_len;\n\n"
+    "static void out_flush(void) {\n"
+    "    (void) fwrite(out_buf, 1, out_len, stdout);\n"
+    "    (void) fflush(stdout);\n"
+    "    out_len = 0;\n"
+    "}\n\n"
+    "static inline void out_byte(unsigned char c) {\n"
+    "    out_buf[out_len++] = c;\n"
+    "    if (out_len == OUT_SIZE || (OUT_FLUSH_LINES && c == '\\n')) {\n"
+    "        out_flush();\n"
+    "    }\n"
+    "}\n\n"
+    "static inline void out_bytes(char const* bytes, size_t size) {\n"
+    "    if (size > OUT_SIZE - out_len) {\n"
+    "        out_flush();\n"
+    "    }\n"
+    "    memcpy(out_buf + out_len, bytes, size);\n"
+    "    out_len += size;\n"
+    "    if (out_len == OUT_SIZE || (OUT_FLUSH_LINES && memchr(bytes, '\\n', size))) {\n"
+    "        out_flush();\n"
+    "    }\n"
+    "}\n";
+// The cell is left unchanged at the end of the input, as with scanf before.
+static char const* const INPUT_FUNC = "\n#define IN_SIZE 65536\n\n"
+                                      "static unsigned char in_buf[IN_SIZE];\n"
+                                      "static size_t in_pos;\n"
+                                      "static size_t in_len;\n\n"
+                                      "static size_t in_fill(void) {\n"
+                                      "#ifdef IN_READ\n"
+                                      "    long const size = (long) read(0, in_buf, IN_SIZE);\n"
+                                      "    return size > 0 ? (size_t) size : 0;\n"
+                                      "#else\n"
+                                      "    int const c = getchar();\n"
+                                      "    in_buf[0]   = (unsigned char) c;\n"
+                                      "    return c == EOF ? 0 : 1;\n"
+                                      "#endif\n"
+                                      "}\n\n"
+                                      "static inline void in_byte(cell_t* cell) {\n"
+                                      "    if (in_pos == in_len) {\n"
+                                      "        out_flush();\n"
+                                      "        in_pos = 0;\n"
+                                      "        in_len = in_fill();\n"
+                                      "        if (in_len == 0) {\n"
+                                      "            return;\n"
+                                      "        }\n"
+                                      "    }\n"
+                                      "    *cell = in_buf[in_pos++];\n"
+                                      "}\n";
+// Mapped tape
+// The pages are only zeroed when they are touched, so even huge tapes start immediately. The tape
+// ends right at the guard behind it, where the pointer usually runs off, and moves of up to
+// TAPE_GUARD bytes beyond either end fault instead of corrupting memory.
+static char const* const TAPE_FUNC =
+    "\n#ifndef TAPE_GUARD\n"
+    "#define TAPE_GUARD 65536\n"
+    "#endif\n\n"
+    "static cell_t* tape_map(void) {\n"
+    "#ifdef TAPE_MMAP\n"
+    "#ifndef MAP_ANONYMOUS\n"
+    "#define MAP_ANONYMOUS MAP_ANON\n"
+    "#endif\n"
+    "    size_t const page  = (size_t) sysconf(_SC_PAGESIZE);\n"
+    "    size_t const guard = (TAPE_GUARD + page - 1) / page * page;\n"
+    "    size_t const size  = (DATA_SIZE * sizeof(cell_t) + page - 1) / page * page;\n"
+    "    unsigned char* const base =\n"
+    "        mmap(NULL, guard + size + guard, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);\n"
+    "    if (base == MAP_FAILED || mprotect(base + guard, size, PROT_READ | PROT_WRITE) != 0) {\n"
+    "        perror(\"tape\");\n"
+    "        exit(1);\n"
+    "    }\n"
+    "    return (cell_t*) (base + guard + size) - DATA_SIZE;\n"
+    "#else\n"
+    "    cell_t* const data = calloc(DATA_SIZE, sizeof(cell_t));\n"
+    "    if (!data) {\n"
+    "        perror(\"tape\");\n"
+    "        exit(1);\n"
+    "    }\n"
+    "    return data;\n"
+    "#endif\n"
+    "}\n";
 static char const* const MAIN_SETUP = "\nint main(void) {\n"
-                                      "    unsigned char data[DATA_SIZE] = {0};\n"
+                                      "    cell_t data[DATA_SIZE] = {0};\n"
                                       "    unsigned int idx = 0;\n"
                                       "    /* PROGRAM */\n";
+static char const* const MAIN_SETUP_MMAP = "\nint main(void) {\n"
+                                           "    cell_t* const data = tape_map();\n"
+                                           "    unsigned int idx = 0;\n"
+                                           "    /* PROGRAM */\n";
+// for programs evaluated completely at transpile time, which only write their output
+static char const* const MAIN_SETUP_NO_TAPE = "\nint main(void) {\n"
+                                              "    /* PROGRAM */\n";
 static char const* const EPILOGUE   = "    /* PROGRAM END */\n"
                                       "    return 0;\n"
                                       "}\n";
+static char const* const IO_EPILOGUE = "    /* PROGRAM END */\n"
+                                       "    out_flush();\n"
+                                       "    return 0;\n"
+                                       "}\n";
+
+// Output of the emitter
+// The C source is appended to the buffer with hand-written formatting (the buffer grows as needed).
+// With a file, the buffer is written in blocks of FLUSH_SIZE, otherwise it holds the whole source.
+typedef struct bf2c_writer_t {
+    core_vec_char_t* buffer;
+    FILE* file;
+} bf2c_writer_t;
+
+// Make room for `size` more bytes and return where they start.
+static char* bf2c_writer_reserve(bf2c_writer_t* writer, size_t size) {
+    core_vec_char_t* buffer = writer->buffer;
+    if (buffer->capacity - buffer->size < size) {
+        size_t const needed  = buffer->size + size;
+        size_t const doubled = 2 * buffer->capacity;
+        core_vec_char_reserve(buffer, needed > doubled ? needed : doubled);
+    }
+    return buffer->data + buffer->size;
+}
+
+static void bf2c_writer_commit(bf2c_writer_t* writer, char const* end) {
+    writer->buffer->size = (size_t) (end - writer->buffer->data);
+}
+
+static void bf2c_write(bf2c_writer_t* writer, char const* data, size_t size) {
+    char* out = bf2c_writer_reserve(writer, size);
+    memcpy(out, data, size);
+    writer->buffer->size += size;
+}
+
+static void bf2c_write_string(bf2c_writer_t* writer, char const* string) {
+    bf2c_write(writer, string, strlen(string));
+}
+
+// Write the buffer to the file, if any. With `force` also if it holds less than FLUSH_SIZE bytes.
+static bool bf2c_writer_flush(bf2c_writer_t* writer, bool force) {
+    core_vec_char_t* buffer = writer->buffer;
+    if (!writer->file || buffer->size == 0 || (!force && buffer->size < FLUSH_SIZE)) {
+        return true;
+    }
+    bool const result = fwrite(buffer->data, 1, buffer->size, writer->file) == buffer->size;
+    buffer->size      = 0;
+    return result;
+}
+
+static char* bf2c_format_uint(char* out, uint64_t value) {
+    char digits[MAX_INTEGER_SIZE];
+    size_t count = 0;
+    do {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+static char* bf2c_format_int(char* out, int64_t value) {
+    if (value < 0) {
+        *out++ = '-';
+        return bf2c_format_uint(out, (uint64_t) 0 - (uint64_t) value);
+    }
+    return bf2c_format_uint(out, (uint64_t) value);
+}
+
+static char* bf2c_format_string(char* out, char const* string, size_t length) {
+    memcpy(out, string, length);
+    return out + length;
+}
+
+#define FORMAT_LITERAL(out, literal) bf2c_format_string((out), (literal), sizeof(literal) - 1)
+
+// Write the sign of the compound assignment, e.g. " += ", and the magnitude of the value.
+static char* bf2c_format_change(char* out, int64_t value) {
+    out = value > 0 ? FORMAT_LITERAL(out, " += ") : FORMAT_LITERAL(out, " -= ");
+    return bf2c_format_uint(out, value > 0 ? (uint64_t) value : (uint64_t) 0 - (uint64_t) value);
+}
+
+// Write the expression of the cell at `offset` relative to idx.
+static char* bf2c_format_cell(char* out, int32_t offset) {
+    if (offset == 0) {
+        return FORMAT_LITERAL(out, "data[idx]");
+    }
+    int64_t const distance = offset > 0 ? offset : -(int64_t) offset;
+    out    = offset > 0 ? FORMAT_LITERAL(out, "data[idx + ") : FORMAT_LITERAL(out, "data[idx - ");
+    out    = bf2c_format_uint(out, (uint64_t) distance);
+    *out++ = ']';
+    return out;
+}
+
+static char* bf2c_format_indentation(char* out, int indentation_level) {
+    static char const spaces[] = "                                ";
+    size_t width = indentation_level > 0 ? (size_t) indentation_level * INDENT_WIDTH : 0;
+    for (; width > sizeof(spaces) - 1; width -= sizeof(spaces) - 1) {
+        out = bf2c_format_string(out, spaces, sizeof(spaces) - 1);
+    }
+    return bf2c_format_string(out, spaces, width);
+}
+
+enum {
+    // initial cells per line of the data initializer
+    STATE_CELLS_PER_LINE = 16,
+    // output bytes per string literal of the precomputed output and of runs of WRITE commands
+    OUTPUT_CHUNK = 64
+};
+
+// A mapped tape is initialized by copying the cells into it.
+static void bf2c_emit_state_cells(bf2c_writer_t* writer,
+                                  program_state_t const* state,
+                                  bool mmap_tape) {
+    bf2c_write_string(writer,
+                      mmap_tape ? "\nint main(void) {\n    static cell_t const data_init[] = {"
+                                : "\nint main(void) {\n    cell_t data[DATA_SIZE] = {");
+    VEC_FOR_EACH (int32_t, cell, state->cells) {
+        char* out = bf2c_writer_reserve(writer, MAX_STATEMENT_SIZE);
+        out       = cell_iterator % STATE_CELLS_PER_LINE == 0 ? FORMAT_LITERAL(out, "\n        ")
+                                                              : FORMAT_LITERAL(out, " ");
+        out       = bf2c_format_uint(out, (uint32_t) cell);
+        *out++    = ',';
+        bf2c_writer_commit(writer, out);
+    }
+    bf2c_write_string(writer, state->cells.size > 0 ? "\n    };\n" : "0};\n");
+    if (mmap_tape) {
+        bf2c_write_string(writer,
+                          "    cell_t* const data = tape_map();\n"
+                          "    memcpy(data, data_init, sizeof(data_init));\n");
+    }
+    char* out = bf2c_writer_reserve(writer, MAX_STATEMENT_SIZE);
+    out       = FORMAT_LITERAL(out, "    unsigned int idx = ");
+    out       = bf2c_format_uint(out, state->index);
+    out       = FORMAT_LITERAL(out, ";\n    /* PROGRAM */\n");
+    bf2c_writer_commit(writer, out);
+}
+
+// Write a chunk of output as a string literal, octal escapes always have three digits so that a
+// following digit is not taken as part of the escape.
+static void bf2c_emit_output(bf2c_writer_t* writer,
+                             int indentation_level,
+                             char const* output,
+                             size_t size) {
+    char* out = bf2c_writer_reserve(
+        writer, MAX_STATEMENT_SIZE + (size_t) INDENT_WIDTH * (size_t) indentation_level + 4 * size);
+    out = bf2c_format_indentation(out, indentation_level);
+    out = FORMAT_LITERAL(out, "out_bytes(\"");
+    for (size_t i = 0; i < size; ++i) {
+        unsigned char const c = (unsigned char) output[i];
+        if (c == '\\' || c == '"' || c == '?') {
+            *out++ = '\\';
+            *out++ = (char) c;
+        } else if (c >= ' ' && c <= '~') {
+            *out++ = (char) c;
+        } else {
+            *out++ = '\\';
+            *out++ = (char) ('0' + (c >> 6));
+            *out++ = (char) ('0' + ((c >> 3) & 7));
+            *out++ = (char) ('0' + (c & 7));
+        }
+    }
+    out = FORMAT_LITERAL(out, "\", ");
+    out = bf2c_format_uint(out, size);
+    out = FORMAT_LITERAL(out, ");\n");
+    bf2c_writer_commit(writer, out);
+}
 
-static bool bf2c_emit_preamble(FILE* file, program_t const* program) {
-    if (command_vec_contains(&program->commands, (command_t){.type = COMMAND_TYPE_DEBUG})) {
-        return fprintf(file, "%s%s%s%s", INCLUDES, PREAMBLE, DEBUG_FUNC, MAIN_SETUP) >= 0;
+// Start main with the tape and output the program reached at transpile time
+// (see bf2c_pass_partial_eval). Without commands left, the tape is not declared at all.
+static void bf2c_emit_state(bf2c_writer_t* writer,
+                            program_state_t const* state,
+                            bool tape,
+                            bool mmap_tape) {
+    if (tape) {
+        bf2c_emit_state_cells(writer, state, mmap_tape);
+    } else {
+        bf2c_write_string(writer, MAIN_SETUP_NO_TAPE);
     }
-    if (command_vec_contains(&program->commands, (command_t){.type = COMMAND_TYPE_OUT}) ||
-        command_vec_contains(&program->commands, (command_t){.type = COMMAND_TYPE_IN}))
-    {
-        return fprintf(file, "%s%s%s", INCLUDES, PREAMBLE, MAIN_SETUP) >= 0;
+    for (size_t i = 0; i < state->output.size; i += OUTPUT_CHUNK) {
+        size_t const size = state->output.size - i < OUTPUT_CHUNK
+                                ? state->output.size - i
+                                : OUTPUT_CHUNK;
+        bf2c_emit_output(writer, 1, state->output.data + i, size);
     }
-    return fprintf(file, "%s%s", PREAMBLE, MAIN_SETUP) >= 0;
 }
 
-static bool bf2c_emit_epilogue(FILE* file) {
-    return fprintf(file, "%s", EPILOGUE) >= 0;
+// Parts of the runtime needed by a program
+typedef struct bf2c_runtime_t {
+    bool debug;
+    bool scan;
+    bool io; // buffered output, needed by the input as well
+    bool input;
+    bool tape; // data and idx, unused if the whole program was evaluated at transpile time
+    size_t tape_size;
+    unsigned cell_bits;
+    bool mmap_tape;
+} bf2c_runtime_t;
+
+static char const* bf2c_cell_type(unsigned cell_bits) {
+    return cell_bits == 32 ? "uint32_t" : cell_bits == 16 ? "uint16_t" : "unsigned char";
+}
+
+static void bf2c_emit_runtime(bf2c_writer_t* writer, bf2c_runtime_t runtime) {
+    bool const uses_stdint = runtime.scan || runtime.cell_bits > 8;
+    bf2c_write_string(writer, runtime.scan ? SCAN_FEATURES : "");
+    bf2c_write_string(writer, uses_stdint ? STDINT_INCLUDES : "");
+    bf2c_write_string(writer, runtime.io || runtime.mmap_tape ? IO_INCLUDES : "");
+    bf2c_write_string(writer,
+                      runtime.scan || runtime.io || runtime.mmap_tape ? STRING_INCLUDES : "");
+    bf2c_write_string(writer, runtime.input ? INPUT_INCLUDES : "");
+    bf2c_write_string(writer, runtime.mmap_tape ? TAPE_INCLUDES : "");
+    bf2c_write_string(writer, uses_stdint || runtime.io || runtime.mmap_tape ? "\n" : "");
+    char* out = bf2c_writer_reserve(writer, strlen(PREAMBLE) + MAX_STATEMENT_SIZE);
+    out       = bf2c_format_string(out, PREAMBLE, strlen(PREAMBLE));
+    out       = bf2c_format_uint(out, runtime.tape_size);
+    out       = FORMAT_LITERAL(out, "\ntypedef ");
+    bf2c_writer_commit(writer, out);
+    bf2c_write_string(writer, bf2c_cell_type(runtime.cell_bits));
+    bf2c_write_string(writer, " cell_t;\n");
+    bf2c_write_string(writer, runtime.io ? OUTPUT_FUNC : "");
+    bf2c_write_string(writer, runtime.input ? INPUT_FUNC : "");
+    bf2c_write_string(writer, runtime.mmap_tape ? TAPE_FUNC : "");
+}
+
+static bf2c_runtime_t bf2c_program_runtime(program_t const* program,
+                                           bf2c_options_t const* options) {
+    command_vec_t const* commands = &program->commands;
+    bool const uses_input         = command_vec_contains(commands, COMMAND_TYPE_IN);
+    bool const uses_debug         = command_vec_contains(commands, COMMAND_TYPE_DEBUG);
+    return (bf2c_runtime_t){
+        .debug = uses_debug,
+        .scan  = command_vec_contains(commands, COMMAND_TYPE_SCAN),
+        .io    = uses_input || uses_debug || program->state.output.size > 0 ||
+              command_vec_contains(commands, COMMAND_TYPE_OUT) ||
+              command_vec_contains(commands, COMMAND_TYPE_WRITE),
+        .input     = uses_input,
+        .tape      = commands->size > 0,
+        .tape_size = options->tape_size,
+        .cell_bits = options->cell_bits,
+        .mmap_tape = options->mmap_tape && commands->size > 0,
+    };
 }
 
-static bool bf2c_emit_command(FILE* file, command_t command, int* indentation_level) {
-    assert(indentation_level);
-    // TODO: improve buffer size handling
-    char buffer[BUFFER_SIZE];
-    int ret = 0;
+static char const* bf2c_scan_func(unsigned cell_bits) {
+    return cell_bits == 8 ? SCAN_FUNC : SCAN_FUNC_WIDE;
+}
+
+static void bf2c_emit_preamble(bf2c_writer_t* writer,
+                               program_t const* program,
+                               bf2c_runtime_t runtime) {
+    bf2c_emit_runtime(writer, runtime);
+    if (runtime.debug) {
+        bf2c_write_string(writer, "\n");
+        bf2c_write_string(writer, DEBUG_FUNC);
+    }
+    bf2c_write_string(writer, runtime.scan ? bf2c_scan_func(runtime.cell_bits) : "");
+    if (bf2c_program_has_state(program) || !runtime.tape) {
+        bf2c_emit_state(writer, &program->state, runtime.tape, runtime.mmap_tape);
+    } else {
+        bf2c_write_string(writer, runtime.mmap_tape ? MAIN_SETUP_MMAP : MAIN_SETUP);
+    }
+}
+
+static void bf2c_emit_command(bf2c_writer_t* writer, command_t command, int* indentation_level) {
+    if (command.type == COMMAND_TYPE_LOOP_END) {
+        --(*indentation_level);
+    }
+    char* out = bf2c_writer_reserve(
+        writer, MAX_STATEMENT_SIZE + (size_t) INDENT_WIDTH * (size_t) *indentation_level);
+    out       = bf2c_format_indentation(out, *indentation_level);
     switch (command.type) {
-        // TODO: improve change value and ptr handling
         case COMMAND_TYPE_CHANGE_VAL:
-            ret = snprintf(buffer,
-                           BUFFER_SIZE * sizeof(buffer[0]),
-                           "data[idx] %c= %d;",
-                           command.value > 0 ? '+' : '-',
-                           abs(command.value));
-            if (ret < 0 || ret >= BUFFER_SIZE) {
-                return false;
-            }
+            out = bf2c_format_cell(out, command.offset);
+            out = bf2c_format_change(out, command.value);
             break;
         case COMMAND_TYPE_CHANGE_PTR:
-            ret = snprintf(buffer,
-                           BUFFER_SIZE * sizeof(buffer[0]),
-                           "idx %c= %d;",
-                           command.value > 0 ? '+' : '-',
-                           abs(command.value));
-            if (ret < 0 || ret >= BUFFER_SIZE) {
-                return false;
-            }
+            out = FORMAT_LITERAL(out, "idx");
+            out = bf2c_format_change(out, command.value);
             break;
-        // strcpy is fine here, because all the string literals are constant
-        // and known to be shorter than the buffer size.
-        case COMMAND_TYPE_OUT: strcpy(buffer, "printf(\"%c\", data[idx]);"); break;
-        case COMMAND_TYPE_IN:  strcpy(buffer, "(void) scanf(\"%c\", &data[idx]);"); break;
+        case COMMAND_TYPE_OUT: out = FORMAT_LITERAL(out, "out_byte(data[idx])"); break;
+        case COMMAND_TYPE_IN:  out = FORMAT_LITERAL(out, "in_byte(&data[idx])"); break;
         case COMMAND_TYPE_LOOP_START:
-            strcpy(buffer, "while (data[idx]) {");
-            ret = 1;
-            break;
+            out = FORMAT_LITERAL(out, "while (data[idx]) {\n");
+            ++(*indentation_level);
+            bf2c_writer_commit(writer, out);
+            return;
         case COMMAND_TYPE_LOOP_END:
-            strcpy(buffer, "}");
-            --(*indentation_level);
+            out = FORMAT_LITERAL(out, "}\n");
+            bf2c_writer_commit(writer, out);
+            return;
+        case COMMAND_TYPE_SET:
+            out = bf2c_format_cell(out, command.offset);
+            out = FORMAT_LITERAL(out, " = ");
+            out = bf2c_format_int(out, command.value);
             break;
-        case COMMAND_TYPE_DEBUG:   strcpy(buffer, "debug(data, idx);"); break;
-        case COMMAND_TYPE_UNKNOWN: strcpy(buffer, "");
+        case COMMAND_TYPE_MUL:
+            out = bf2c_format_cell(out, command.offset);
+            if (command.value == 1 || command.value == -1) {
+                out = command.value > 0 ? FORMAT_LITERAL(out, " += ") : FORMAT_LITERAL(out, " -= ");
+            } else {
+                out = bf2c_format_change(out, command.value);
+                out = FORMAT_LITERAL(out, " * ");
+            }
+            out = FORMAT_LITERAL(out, "data[idx]");
+            break;
+        case COMMAND_TYPE_SCAN:
+            out = FORMAT_LITERAL(out, "idx = scan(data, idx, ");
+            out = bf2c_format_int(out, command.value);
+            *out++ = ')';
+            break;
+        case COMMAND_TYPE_DEBUG: out = FORMAT_LITERAL(out, "debug(data, idx)"); break;
+        case COMMAND_TYPE_WRITE: {
+            char const byte = (char) command.value;
+            bf2c_emit_output(writer, *indentation_level, &byte, 1);
+            return;
+        }
+        case COMMAND_TYPE_UNKNOWN:
+            *out++ = '\n';
+            bf2c_writer_commit(writer, out);
+            return;
     }
-    int const res = fprintf(file, "%*c%s\n", INDENT_WIDTH * *indentation_level, ' ', buffer) >= 0;
-    if (ret == 1) {
-        ++(*indentation_level);
+    out = FORMAT_LITERAL(out, ";\n");
+    bf2c_writer_commit(writer, out);
+}
+
+static void bf2c_emit_line(bf2c_writer_t* writer, int indentation_level, char const* line) {
+    size_t const length = strlen(line);
+    size_t const width  = (size_t) INDENT_WIDTH * (size_t) indentation_level;
+    char* out           = bf2c_writer_reserve(writer, width + length);
+    out                 = bf2c_format_indentation(out, indentation_level);
+    out                 = bf2c_format_string(out, line, length);
+    bf2c_writer_commit(writer, out);
+}
+
+// Emit the MUL commands starting at `begin` with the SET clearing the counter, returns the index
+// behind them. The loop they replace only touched the other cells if the counter was not zero,
+// these cells may be off the tape otherwise.
+static size_t bf2c_emit_mul_group(bf2c_writer_t* writer,
+                                  command_vec_t const* commands,
+                                  size_t begin,
+                                  int* indentation_level) {
+    size_t end = begin;
+    while (end < commands->size && commands->types[end] == COMMAND_TYPE_MUL) {
+        ++end;
     }
-    return res;
+    command_t const clear = end < commands->size ? command_vec_at(commands, end)
+                                                 : (command_t){0, COMMAND_TYPE_UNKNOWN, 0};
+    if (clear.type == COMMAND_TYPE_SET && clear.value == 0 && clear.offset == 0) {
+        ++end;
+    }
+    bf2c_emit_line(writer, *indentation_level, "if (data[idx]) {\n");
+    ++(*indentation_level);
+    for (size_t i = begin; i < end; ++i) {
+        bf2c_emit_command(writer, command_vec_at(commands, i), indentation_level);
+    }
+    --(*indentation_level);
+    bf2c_emit_line(writer, *indentation_level, "}\n");
+    return end;
 }
 
-// TODO: return a RESULT for more precise error handling instead of bool
-bool bf2c_emit_c_to_file(FILE* file, program_t const* program) {
-    if (!bf2c_emit_preamble(file, program)) {
+static bool bf2c_emit_commands(bf2c_writer_t* writer,
+                               command_vec_t const* commands,
+                               int* indentation_level) {
+    for (size_t i = 0; i < commands->size; ++i) {
+        if (commands->types[i] == COMMAND_TYPE_WRITE) {
+            // a run of known bytes becomes a single write
+            char bytes[OUTPUT_CHUNK];
+            size_t size = 0;
+            for (; i < commands->size && commands->types[i] == COMMAND_TYPE_WRITE &&
+                   size < OUTPUT_CHUNK;
+                 ++i)
+            {
+                bytes[size++] = (char) commands->values[i];
+            }
+            --i;
+            bf2c_emit_output(writer, *indentation_level, bytes, size);
+        } else if (commands->types[i] == COMMAND_TYPE_MUL) {
+            i = bf2c_emit_mul_group(writer, commands, i, indentation_level) - 1;
+        } else {
+            bf2c_emit_command(writer, command_vec_at(commands, i), indentation_level);
+        }
+        if (!bf2c_writer_flush(writer, false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool bf2c_emit_program(bf2c_writer_t* writer,
+                              program_t const* program,
+                              bf2c_options_t const* options) {
+    if (bf2c_program_has_state(program) && (program->state.cells.size > options->tape_size ||
+                                             program->state.index >= options->tape_size)) {
+        LOG_ERROR("The evaluated state does not fit on a tape of %zu cells.", options->tape_size);
         return false;
     }
+    bf2c_runtime_t const runtime = bf2c_program_runtime(program, options);
+    bf2c_emit_preamble(writer, program, runtime);
     int indentation_level = 1;
-    VEC_FOR_EACH (command_t, cmd, program->commands) {
-        if (!bf2c_emit_command(file, cmd, &indentation_level)) {
-            return false;
-        }
+    if (!bf2c_emit_commands(writer, &program->commands, &indentation_level)) {
+        return false;
     }
-    return bf2c_emit_epilogue(file);
+    bf2c_write_string(writer, runtime.io ? IO_EPILOGUE : EPILOGUE);
+    return bf2c_writer_flush(writer, true);
+}
+
+bool bf2c_emit_c_to_buffer(core_vec_char_t* buffer,
+                           program_t const* program,
+                           bf2c_options_t const* options) {
+    ABORT_IF(!buffer || !program || !options);
+    bf2c_writer_t writer = {buffer, NULL};
+    return bf2c_emit_program(&writer, program, options);
+}
+
+// TODO: return a RESULT for more precise error handling instead of bool
+bool bf2c_emit_c_to_file(FILE* file, program_t const* program, bf2c_options_t const* options) {
+    ABORT_IF(!file || !program || !options);
+    core_vec_char_t buffer = core_vec_char_with_capacity(FLUSH_SIZE + MAX_STATEMENT_SIZE);
+    bf2c_writer_t writer   = {&buffer, file};
+    bool const result      = bf2c_emit_program(&writer, program, options);
+    core_vec_char_destroy(&buffer);
+    return result;
 }
 
-bool bf2c_emit_c_to_filename(char const* filename, program_t const* program) {
+bool bf2c_emit_c_to_filename(char const* filename,
+                             program_t const* program,
+                             bf2c_options_t const* options) {
     FILE* file = fopen(filename, "w");
     if (!file) {
         return false;
     }
-    bool result = bf2c_emit_c_to_file(file, program);
-    (void) fclose(file);
-    return result;
+    bool result = bf2c_emit_c_to_file(file, program, options);
+    return fclose(file) == 0 && result;
+}
+
+bool bf2c_emitter_begin(bf2c_emitter_t* emitter, FILE* file, bf2c_options_t const* options) {
+    ABORT_IF(!emitter || !file || !options);
+    *emitter = (bf2c_emitter_t){.file = file, .indentation_level = 1, .options = *options};
+    // The rest of the program is unknown, so always include everything and declare the helpers.
+    bf2c_writer_t writer         = {&emitter->buffer, file};
+    bf2c_runtime_t const runtime = {.debug     = true,
+                                    .scan      = true,
+                                    .io        = true,
+                                    .input     = true,
+                                    .tape      = true,
+                                    .tape_size = options->tape_size,
+                                    .cell_bits = options->cell_bits,
+                                    .mmap_tape = options->mmap_tape};
+    bf2c_emit_runtime(&writer, runtime);
+    bf2c_write_string(&writer, DEBUG_DECL);
+    bf2c_write_string(&writer, SCAN_DECL);
+    bf2c_write_string(&writer, options->mmap_tape ? MAIN_SETUP_MMAP : MAIN_SETUP);
+    return bf2c_writer_flush(&writer, true);
+}
+
+bool bf2c_emitter_emit(bf2c_emitter_t* emitter, program_t const* fragment) {
+    ABORT_IF(!emitter || !fragment);
+    command_vec_t const* commands = &fragment->commands;
+    emitter->uses_debug = emitter->uses_debug || command_vec_contains(commands, COMMAND_TYPE_DEBUG);
+    emitter->uses_scan  = emitter->uses_scan || command_vec_contains(commands, COMMAND_TYPE_SCAN);
+    bf2c_writer_t writer = {&emitter->buffer, emitter->file};
+    // the fragment is written completely, so the output keeps up with the input
+    return bf2c_emit_commands(&writer, commands, &emitter->indentation_level) &&
+           bf2c_writer_flush(&writer, true);
+}
+
+bool bf2c_emitter_end(bf2c_emitter_t* emitter) {
+    ABORT_IF(!emitter);
+    bf2c_writer_t writer = {&emitter->buffer, emitter->file};
+    bf2c_write_string(&writer, IO_EPILOGUE);
+    if (emitter->uses_debug) {
+        bf2c_write_string(&writer, "\n");
+        bf2c_write_string(&writer, DEBUG_FUNC);
+    }
+    if (emitter->uses_scan) {
+        bf2c_write_string(&writer, bf2c_scan_func(emitter->options.cell_bits));
+    }
+    return bf2c_writer_flush(&writer, true);
+}
+
+void bf2c_emitter_destroy(bf2c_emitter_t* emitter) {
+    if (emitter) {
+        core_vec_char_destroy(&emitter->buffer);
+    }
 }
@@ -0,0 +1,321 @@
+#include "bf2c/cache.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bf2c/bfir.h"
+#include "bf2c/program.h"
+#include "core/abort.h"
+#include "core/hash.h"
+#include "core/logging.h"
+
+#ifdef BF2C_HAVE_DIRENT
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+#ifdef BF2C_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef BF2C_HAVE_UTIME_H
+#include <utime.h>
+#endif
+
+enum {
+    // room for the separator, the entry name and a temporary suffix behind the directory
+    PATH_EXTRA_SIZE = 96
+};
+
+#ifdef _WIN32
+#define EXECUTABLE_EXTENSION ".exe"
+#else
+#define EXECUTABLE_EXTENSION ".bin"
+#endif
+
+typedef struct bf2c_cache_entry_t {
+    char* path;
+    uint64_t size;
+    int64_t mtime;
+} bf2c_cache_entry_t;
+
+// Returns the path of the entry with the extension (or of its temporary file), to be freed by the
+// caller.
+static char* bf2c_cache_path(bf2c_cache_t const* cache,
+                             bf2c_cache_key_t key,
+                             char const* extension,
+                             bool temporary) {
+    size_t const size = strlen(cache->directory) + PATH_EXTRA_SIZE;
+    char* path        = malloc(size);
+    LOG_MSG_AND_ABORT_IF(!path, "Failed to allocate cache path.");
+    // the size is part of the name to make collisions of the hash even less likely
+    int ret = snprintf(path,
+                       size,
+                       "%s/%016" PRIx64 "-%016" PRIx64 "%s",
+                       cache->directory,
+                       key.hash,
+                       key.size,
+                       extension);
+    if (temporary && ret >= 0) {
+#ifdef BF2C_HAVE_UNISTD_H
+        // unique per process, so concurrent writers never share a temporary file
+        unsigned long const id = (unsigned long) getpid();
+#else
+        unsigned long const id = 0;
+#endif
+        size_t const length = strlen(path);
+        ret                 = snprintf(path + length, size - length, ".tmp%lu", id);
+    }
+    LOG_MSG_AND_ABORT_IF(ret < 0, "Failed to format cache path.");
+    return path;
+}
+
+bf2c_cache_t bf2c_cache_create(char const* directory, uint64_t max_size) {
+    ABORT_IF(!directory);
+#ifdef BF2C_HAVE_DIRENT
+    size_t const length = strlen(directory);
+    char* path          = malloc(length + 1);
+    LOG_MSG_AND_ABORT_IF(!path, "Failed to allocate cache path.");
+    memcpy(path, directory, length + 1);
+    // the parents first, failures show up when creating the directory itself
+    for (size_t i = 1; i < length; ++i) {
+        if (path[i] == '/') {
+            path[i] = '\0';
+            (void) mkdir(path, 0777);
+            path[i] = '/';
+        }
+    }
+    free(path);
+    if (mkdir(directory, 0777) != 0 && errno != EEXIST) {
+        LOG_ERROR("Failed to create cache directory: %s", directory);
+    }
+#endif
+    return (bf2c_cache_t){.directory = directory, .max_size = max_size};
+}
+
+bf2c_cache_key_t bf2c_cache_key(char const* source, size_t size, char const* salt) {
+    ABORT_IF(!source && size > 0);
+    uint64_t hash = core_hash64(source, size, BFIR_VERSION);
+    if (salt) {
+        hash = core_hash64(salt, strlen(salt), hash);
+    }
+    return (bf2c_cache_key_t){hash, size};
+}
+
+bf2c_cache_key_t bf2c_cache_program_key(program_t const* program, char const* salt) {
+    ABORT_IF(!program);
+    command_vec_t const* commands = &program->commands;
+    program_state_t const* state  = &program->state;
+    uint64_t hash = core_hash64(commands->types, commands->size, BFIR_VERSION);
+    hash          = core_hash64(commands->values, commands->size * sizeof(int32_t), hash);
+    if (commands->offsets) {
+        hash = core_hash64(commands->offsets, commands->size * sizeof(int32_t), hash);
+    }
+    hash = core_hash64(program->wide_deltas.data,
+                       program->wide_deltas.size * sizeof(command_wide_value_t),
+                       hash);
+    hash = core_hash64(state->cells.data, state->cells.size * sizeof(int32_t), hash);
+    hash = core_hash64(&state->index, sizeof(state->index), hash);
+    hash = core_hash64(state->output.data, state->output.size, hash);
+    if (salt) {
+        hash = core_hash64(salt, strlen(salt), hash);
+    }
+    return (bf2c_cache_key_t){hash, commands->size};
+}
+
+// The modification time orders the entries for eviction.
+static void bf2c_cache_touch(char const* path) {
+#ifdef BF2C_HAVE_UTIME_H
+    (void) utime(path, NULL);
+#else
+    (void) path;
+#endif
+}
+
+bool bf2c_cache_load(bf2c_cache_t* cache,
+                     bf2c_cache_key_t key,
+                     bf2c_options_t const* options,
+                     program_t* program) {
+    ABORT_IF(!cache || !options || !program);
+    char* path = bf2c_cache_path(cache, key, BFIR_EXTENSION, false);
+    FILE* file = fopen(path, "rb");
+    bool hit   = false;
+    if (file) {
+        (void) fclose(file);
+        hit = bf2c_bfir_load_from_filename(path, options, program);
+        if (!hit) {
+            LOG_DEBUG("Removing broken cache entry: %s", path);
+            (void) remove(path);
+        }
+    }
+    if (hit) {
+        bf2c_cache_touch(path);
+        ++cache->hits;
+        LOG_DEBUG("Cache hit: %s", path);
+    } else {
+        ++cache->misses;
+        LOG_DEBUG("Cache miss: %s", path);
+    }
+    free(path);
+    return hit;
+}
+
+#ifdef BF2C_HAVE_DIRENT
+// Whether the file name ends with the extension.
+static bool bf2c_cache_has_extension(char const* name, char const* extension) {
+    size_t const length     = strlen(name);
+    size_t const ext_length = strlen(extension);
+    return length > ext_length && strcmp(name + length - ext_length, extension) == 0;
+}
+
+static int bf2c_cache_entry_cmp(void const* lhs, void const* rhs) {
+    int64_t const a = ((bf2c_cache_entry_t const*) lhs)->mtime;
+    int64_t const b = ((bf2c_cache_entry_t const*) rhs)->mtime;
+    return (a > b) - (a < b);
+}
+
+// Remove the least recently used entries until the directory fits into the size limit. The entry at
+// `keep`, which was just stored, is never removed.
+static void bf2c_cache_evict(bf2c_cache_t* cache, char const* keep) {
+    DIR* dir = opendir(cache->directory);
+    if (!dir) {
+        return;
+    }
+    bf2c_cache_entry_t* entries = NULL;
+    size_t count                = 0;
+    size_t capacity             = 0;
+    uint64_t total              = 0;
+    struct dirent const* ent    = NULL;
+    while ((ent = readdir(dir)) != NULL) {
+        if (!bf2c_cache_has_extension(ent->d_name, BFIR_EXTENSION) &&
+            !bf2c_cache_has_extension(ent->d_name, EXECUTABLE_EXTENSION))
+        {
+            continue;
+        }
+        size_t const size = strlen(cache->directory) + strlen(ent->d_name) + 2;
+        char* path        = malloc(size);
+        LOG_MSG_AND_ABORT_IF(!path, "Failed to allocate cache path.");
+        (void) snprintf(path, size, "%s/%s", cache->directory, ent->d_name);
+        struct stat info;
+        if (stat(path, &info) != 0 || !S_ISREG(info.st_mode)) {
+            free(path);
+            continue;
+        }
+        total += (uint64_t) info.st_size;
+        if (keep && strcmp(path, keep) == 0) {
+            free(path);
+            continue;
+        }
+        if (count == capacity) {
+            capacity                      = capacity == 0 ? 64 : 2 * capacity;
+            bf2c_cache_entry_t* allocated = realloc(entries, capacity * sizeof(entries[0]));
+            LOG_MSG_AND_ABORT_IF(!allocated, "Failed to allocate cache entries.");
+            entries = allocated;
+        }
+        entries[count++] =
+            (bf2c_cache_entry_t){path, (uint64_t) info.st_size, (int64_t) info.st_mtime};
+    }
+    (void) closedir(dir);
+
+    if (total > cache->max_size && count > 0) {
+        qsort(entries, count, sizeof(entries[0]), bf2c_cache_entry_cmp);
+        for (size_t i = 0; i < count && total > cache->max_size; ++i) {
+            if (remove(entries[i].path) == 0) {
+                total -= entries[i].size;
+                ++cache->evictions;
+                LOG_DEBUG("Cache eviction: %s", entries[i].path);
+            }
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        free(entries[i].path);
+    }
+    free(entries);
+}
+#endif
+
+bool bf2c_cache_store(bf2c_cache_t* cache,
+                      bf2c_cache_key_t key,
+                      bf2c_options_t const* options,
+                      program_t const* program) {
+    ABORT_IF(!cache || !options || !program);
+    char* path      = bf2c_cache_path(cache, key, BFIR_EXTENSION, false);
+    char* temporary = bf2c_cache_path(cache, key, BFIR_EXTENSION, true);
+    // write to a temporary file first, so readers never see a partial entry
+    bool result = bf2c_bfir_write_to_filename(temporary, program, options);
+    if (result && rename(temporary, path) != 0) {
+        // rename does not replace existing files everywhere
+        (void) remove(path);
+        result = rename(temporary, path) == 0;
+    }
+    if (!result) {
+        LOG_DEBUG("Failed to store cache entry: %s", path);
+        (void) remove(temporary);
+    }
+    free(temporary);
+#ifdef BF2C_HAVE_DIRENT
+    bf2c_cache_evict(cache, path);
+#endif
+    free(path);
+    return result;
+}
+
+char* bf2c_cache_load_executable(bf2c_cache_t* cache, bf2c_cache_key_t key) {
+    ABORT_IF(!cache);
+    char* path = bf2c_cache_path(cache, key, EXECUTABLE_EXTENSION, false);
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        ++cache->misses;
+        LOG_DEBUG("Cache miss: %s", path);
+        free(path);
+        return NULL;
+    }
+    (void) fclose(file);
+    bf2c_cache_touch(path);
+    ++cache->hits;
+    LOG_DEBUG("Cache hit: %s", path);
+    return path;
+}
+
+char* bf2c_cache_store_executable(bf2c_cache_t* cache,
+                                  bf2c_cache_key_t key,
+                                  bf2c_cache_build_t build,
+                                  void* context) {
+    ABORT_IF(!cache || !build);
+    char* path      = bf2c_cache_path(cache, key, EXECUTABLE_EXTENSION, false);
+    char* temporary = bf2c_cache_path(cache, key, EXECUTABLE_EXTENSION, true);
+    // built next to the entry and renamed, so concurrent runs never execute a partial file
+    bool result = build(temporary, context);
+    if (result && rename(temporary, path) != 0) {
+        (void) remove(path);
+        result = rename(temporary, path) == 0;
+    }
+    if (!result) {
+        LOG_DEBUG("Failed to store cache entry: %s", path);
+        (void) remove(temporary);
+        free(path);
+        path = NULL;
+    }
+    free(temporary);
+#ifdef BF2C_HAVE_DIRENT
+    bf2c_cache_evict(cache, path);
+#endif
+    return path;
+}
+
+void bf2c_cache_log_stats(bf2c_cache_t const* cache) {
+    ABORT_IF(!cache);
+    // only in verbose mode, but unlike LOG_DEBUG also in release builds
+    if (core_logging_get_level() >= LOG_LEVEL_DEBUG) {
+        LOG_INFO("Cache %s: %zu hits, %zu misses, %zu evictions",
+                 cache->directory,
+                 cache->hits,
+                 cache->misses,
+                 cache->evictions);
+    }
+}
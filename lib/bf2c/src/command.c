@@ -1,12 +1,187 @@
 #include "bf2c/command.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "bf2c/token.h"
+#include "core/abort.h"
 #include "core/vector.h"
 
-#define COMMAND_CMP(a, b) TRIVIAL_COMP((a).type, (b).type)
-VECTOR_DEFINE_WITH_PREFIX(command_vec_t, command_vec, command_t, void, COMMAND_CMP)
+command_vec_t command_vec_create(void) {
+    return (command_vec_t){0};
+}
+
+command_vec_t command_vec_with_capacity(size_t capacity) {
+    command_vec_t vector = command_vec_create();
+    command_vec_reserve(&vector, capacity);
+    return vector;
+}
+
+command_vec_t command_vec_from_range(command_vec_t const* vector, size_t begin, size_t end) {
+    ABORT_IF(!vector || begin > end || end > vector->size);
+    command_vec_t copy = command_vec_with_capacity(end - begin);
+    if (end > begin) {
+        memcpy(copy.types, vector->types + begin, (end - begin) * sizeof(copy.types[0]));
+        memcpy(copy.values, vector->values + begin, (end - begin) * sizeof(copy.values[0]));
+        if (vector->offsets) {
+            command_vec_enable_offsets(&copy);
+            memcpy(copy.offsets, vector->offsets + begin, (end - begin) * sizeof(copy.offsets[0]));
+        }
+    }
+    copy.size = end - begin;
+    return copy;
+}
+
+void command_vec_destroy(command_vec_t* vector) {
+    if (vector) {
+        if (!vector->is_borrowed) {
+            free(vector->types);
+            free(vector->values);
+            free(vector->offsets);
+        }
+        *vector = command_vec_create();
+    }
+}
+
+bool command_vec_is_empty(command_vec_t const* vector) {
+    ABORT_IF(!vector);
+    return vector->size == 0;
+}
+
+bool command_vec_contains(command_vec_t const* vector, command_type_t type) {
+    ABORT_IF(!vector);
+    return vector->size > 0 && memchr(vector->types, (int) type, vector->size) != NULL;
+}
+
+size_t command_vec_count(command_vec_t const* vector, command_type_t type) {
+    ABORT_IF(!vector);
+    size_t count = 0;
+    for (size_t i = 0; i < vector->size; ++i) {
+        count += vector->types[i] == (uint8_t) type;
+    }
+    return count;
+}
+
+void command_vec_reserve(command_vec_t* vector, size_t new_capacity) {
+    ABORT_IF(!vector);
+    if (new_capacity <= vector->capacity) {
+        return;
+    }
+    if (vector->is_borrowed) {
+        command_vec_t copy = command_vec_from_range(vector, 0, vector->size);
+        *vector            = copy;
+    }
+    uint8_t* types = realloc(vector->types, new_capacity * sizeof(vector->types[0]));
+    LOG_MSG_AND_ABORT_IF(!types, "Failed to allocate memory for vector.");
+    vector->types   = types;
+    int32_t* values = realloc(vector->values, new_capacity * sizeof(vector->values[0]));
+    LOG_MSG_AND_ABORT_IF(!values, "Failed to allocate memory for vector.");
+    vector->values = values;
+    if (vector->offsets) {
+        int32_t* offsets = realloc(vector->offsets, new_capacity * sizeof(vector->offsets[0]));
+        LOG_MSG_AND_ABORT_IF(!offsets, "Failed to allocate memory for vector.");
+        vector->offsets = offsets;
+    }
+    vector->capacity = new_capacity;
+}
+
+void command_vec_enable_offsets(command_vec_t* vector) {
+    ABORT_IF(!vector);
+    if (vector->offsets || vector->capacity == 0) {
+        return;
+    }
+    if (vector->is_borrowed) {
+        // the offsets are owned by the vector, so the other arrays have to be as well
+        command_vec_t copy = command_vec_from_range(vector, 0, vector->size);
+        *vector            = copy;
+    }
+    vector->offsets = calloc(vector->capacity, sizeof(vector->offsets[0]));
+    LOG_MSG_AND_ABORT_IF(!vector->offsets, "Failed to allocate memory for vector.");
+}
+
+void command_vec_shrink_to_fit(command_vec_t* vector) {
+    ABORT_IF(!vector);
+    if (vector->size == vector->capacity || vector->is_borrowed) {
+        return;
+    }
+    if (vector->size == 0) {
+        command_vec_destroy(vector);
+        return;
+    }
+    uint8_t* types = realloc(vector->types, vector->size * sizeof(vector->types[0]));
+    LOG_MSG_AND_ABORT_IF(!types, "Failed to allocate memory for vector.");
+    vector->types   = types;
+    int32_t* values = realloc(vector->values, vector->size * sizeof(vector->values[0]));
+    LOG_MSG_AND_ABORT_IF(!values, "Failed to allocate memory for vector.");
+    vector->values = values;
+    if (vector->offsets) {
+        int32_t* offsets = realloc(vector->offsets, vector->size * sizeof(vector->offsets[0]));
+        LOG_MSG_AND_ABORT_IF(!offsets, "Failed to allocate memory for vector.");
+        vector->offsets = offsets;
+    }
+    vector->capacity = vector->size;
+}
+
+void command_vec_push_back(command_vec_t* vector, command_t command) {
+    ABORT_IF(!vector);
+    if (vector->size == vector->capacity) {
+        command_vec_reserve(vector, vector->capacity == 0 ? 64 : 2 * vector->capacity);
+    }
+    command_vec_set(vector, vector->size++, command);
+}
+
+void command_vec_erase_front(command_vec_t* vector, size_t count) {
+    ABORT_IF(!vector || count > vector->size);
+    size_t const rest = vector->size - count;
+    if (count > 0 && rest > 0) {
+        memmove(vector->types, vector->types + count, rest * sizeof(vector->types[0]));
+        memmove(vector->values, vector->values + count, rest * sizeof(vector->values[0]));
+        if (vector->offsets) {
+            memmove(vector->offsets, vector->offsets + count, rest * sizeof(vector->offsets[0]));
+        }
+    }
+    vector->size = rest;
+}
+
+#define COMMAND_WIDE_CMP(a, b) TRIVIAL_COMP((a).index, (b).index)
+VECTOR_DEFINE_WITH_PREFIX(command_wide_vec_t,
+                          command_wide_vec,
+                          command_wide_value_t,
+                          void,
+                          COMMAND_WIDE_CMP)
+
+void command_vec_link_loop(command_vec_t* vector,
+                           command_wide_vec_t* wide_deltas,
+                           size_t start,
+                           size_t end) {
+    ABORT_IF(!vector || !wide_deltas || start >= end || end >= vector->size);
+    size_t const delta = end - start;
+    if (delta <= INT32_MAX) {
+        vector->values[start] = (int32_t) delta;
+        vector->values[end]   = -(int32_t) delta;
+        return;
+    }
+    vector->values[start] = COMMAND_VALUE_WIDE;
+    vector->values[end]   = COMMAND_VALUE_WIDE;
+    command_wide_vec_push_back(wide_deltas, (command_wide_value_t){start, (int64_t) delta});
+    command_wide_vec_push_back(wide_deltas, (command_wide_value_t){end, -(int64_t) delta});
+}
+
+static int command_wide_value_cmp(void const* lhs, void const* rhs) {
+    size_t const a = ((command_wide_value_t const*) lhs)->index;
+    size_t const b = ((command_wide_value_t const*) rhs)->index;
+    return (a > b) - (a < b);
+}
+
+void command_wide_vec_sort(command_wide_vec_t* vector) {
+    ABORT_IF(!vector);
+    if (vector->size > 1) {
+        qsort(vector->data, vector->size, sizeof(command_wide_value_t), command_wide_value_cmp);
+    }
+}
 
 command_type_t bf2c_command_from_token(token_type_t token) {
     switch (token) {
@@ -44,6 +219,10 @@ char const* bf2c_command_type_to_string(command_type_t type) {
         case COMMAND_TYPE_LOOP_START: return "LOOP_START";
         case COMMAND_TYPE_LOOP_END:   return "LOOP_END";
         case COMMAND_TYPE_DEBUG:      return "DEBUG";
+        case COMMAND_TYPE_SET:        return "SET";
+        case COMMAND_TYPE_MUL:        return "MUL";
+        case COMMAND_TYPE_SCAN:       return "SCAN";
+        case COMMAND_TYPE_WRITE:      return "WRITE";
         case COMMAND_TYPE_UNKNOWN:    return "UNKNOWN";
     }
     return "UNKNOWN"; // should be unreachable
@@ -0,0 +1,179 @@
+#include "bf2c/exec.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bf2c/c_emitter.h"
+#include "bf2c/cache.h"
+#include "bf2c/options.h"
+#include "bf2c/program.h"
+#include "core/abort.h"
+#include "core/logging.h"
+#include "core/vector.h"
+
+#ifdef BF2C_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+enum {
+    // the options of the emitted code in the cache key
+    OPTIONS_SALT_SIZE = 128
+};
+
+typedef struct bf2c_exec_build_t {
+    program_t const* program;
+    bf2c_options_t const* options;
+    bf2c_compiler_t compiler;
+} bf2c_exec_build_t;
+
+static void bf2c_exec_append(core_vec_char_t* command, char const* text) {
+    for (; *text; ++text) {
+        core_vec_char_push_back(command, *text);
+    }
+}
+
+// Append the argument quoted for the shell of system().
+static void bf2c_exec_append_quoted(core_vec_char_t* command, char const* argument) {
+#ifdef _WIN32
+    // cmd.exe, paths cannot contain double quotes
+    core_vec_char_push_back(command, '"');
+    bf2c_exec_append(command, argument);
+    core_vec_char_push_back(command, '"');
+#else
+    core_vec_char_push_back(command, '\'');
+    for (; *argument; ++argument) {
+        if (*argument == '\'') {
+            bf2c_exec_append(command, "'\\''");
+        } else {
+            core_vec_char_push_back(command, *argument);
+        }
+    }
+    core_vec_char_push_back(command, '\'');
+#endif
+}
+
+bf2c_compiler_t bf2c_compiler_default(void) {
+    char const* cc = getenv("CC");
+    return (bf2c_compiler_t){cc && *cc ? cc : BF2C_DEFAULT_CC, BF2C_DEFAULT_CFLAGS};
+}
+
+// Returns base followed by suffix, to be freed by the caller.
+static char* bf2c_exec_concat(char const* base, char const* suffix) {
+    size_t const base_length   = strlen(base);
+    size_t const suffix_length = strlen(suffix);
+    char* result               = malloc(base_length + suffix_length + 1);
+    LOG_MSG_AND_ABORT_IF(!result, "Failed to allocate path.");
+    memcpy(result, base, base_length);
+    memcpy(result + base_length, suffix, suffix_length + 1);
+    return result;
+}
+
+char* bf2c_exec_cache_directory(void) {
+#ifdef _WIN32
+    char const* local = getenv("LOCALAPPDATA");
+    return local && *local ? bf2c_exec_concat(local, "\\bf2c") : NULL;
+#else
+    char const* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) {
+        return bf2c_exec_concat(xdg, "/bf2c");
+    }
+    char const* home = getenv("HOME");
+    return home && *home ? bf2c_exec_concat(home, "/.cache/bf2c") : NULL;
+#endif
+}
+
+bool bf2c_exec_compile(program_t const* program,
+                       bf2c_options_t const* options,
+                       bf2c_compiler_t compiler,
+                       char const* executable) {
+    ABORT_IF(!program || !options || !compiler.command || !compiler.flags || !executable);
+    char* source = bf2c_exec_concat(executable, ".c");
+    bool success = bf2c_emit_c_to_filename(source, program, options);
+    if (success) {
+        core_vec_char_t command = core_vec_char_create();
+        bf2c_exec_append(&command, compiler.command);
+        core_vec_char_push_back(&command, ' ');
+        bf2c_exec_append(&command, compiler.flags);
+        bf2c_exec_append(&command, " -o ");
+        bf2c_exec_append_quoted(&command, executable);
+        core_vec_char_push_back(&command, ' ');
+        bf2c_exec_append_quoted(&command, source);
+        core_vec_char_push_back(&command, '\0');
+        LOG_DEBUG("Compiling: %s", command.data);
+        // the diagnostics of the compiler go to stderr
+        success = system(command.data) == 0;
+        if (!success) {
+            LOG_ERROR("The C compiler failed: %s", command.data);
+        }
+        core_vec_char_destroy(&command);
+    } else {
+        LOG_ERROR("Failed to write the C file: %s", source);
+    }
+    (void) remove(source);
+    free(source);
+    return success;
+}
+
+static bool bf2c_exec_build_entry(char const* path, void* context) {
+    bf2c_exec_build_t const* build = (bf2c_exec_build_t const*) context;
+    return bf2c_exec_compile(build->program, build->options, build->compiler, path);
+}
+
+char* bf2c_exec_build(bf2c_cache_t* cache,
+                      program_t const* program,
+                      bf2c_options_t const* options,
+                      bf2c_compiler_t compiler,
+                      char const* salt) {
+    ABORT_IF(!cache || !program || !options || !compiler.command || !compiler.flags);
+    // the options which change the emitted code, the program covers the others
+    char emitted[OPTIONS_SALT_SIZE];
+    int const ret = snprintf(emitted,
+                             sizeof(emitted),
+                             ";tape-size=%zu;cell-bits=%u;mmap-tape=%d;cc=",
+                             options->tape_size,
+                             options->cell_bits,
+                             (int) options->mmap_tape);
+    ABORT_IF(ret < 0 || (size_t) ret >= sizeof(emitted));
+    core_vec_char_t key_salt = core_vec_char_create();
+    bf2c_exec_append(&key_salt, salt ? salt : "");
+    bf2c_exec_append(&key_salt, emitted);
+    bf2c_exec_append(&key_salt, compiler.command);
+    bf2c_exec_append(&key_salt, ";cflags=");
+    bf2c_exec_append(&key_salt, compiler.flags);
+    core_vec_char_push_back(&key_salt, '\0');
+    bf2c_cache_key_t const key = bf2c_cache_program_key(program, key_salt.data);
+    core_vec_char_destroy(&key_salt);
+    char* executable = bf2c_cache_load_executable(cache, key);
+    if (!executable) {
+        bf2c_exec_build_t build = {program, options, compiler};
+        executable = bf2c_cache_store_executable(cache, key, bf2c_exec_build_entry, &build);
+    }
+    return executable;
+}
+
+bool bf2c_exec_run(char const* executable, int* status) {
+    ABORT_IF(!executable || !status);
+    // written before the process is replaced or the executable writes
+    (void) fflush(stdout);
+    (void) fflush(stderr);
+#ifdef BF2C_HAVE_UNISTD_H
+    char* const argv[] = {(char*) executable, NULL};
+    (void) execv(executable, argv);
+    LOG_ERROR("Failed to run: %s", executable);
+    return false;
+#else
+    core_vec_char_t command = core_vec_char_create();
+    bf2c_exec_append_quoted(&command, executable);
+    core_vec_char_push_back(&command, '\0');
+    *status = system(command.data);
+    core_vec_char_destroy(&command);
+    if (*status == -1) {
+        LOG_ERROR("Failed to run: %s", executable);
+        return false;
+    }
+    return true;
+#endif
+}
@@ -0,0 +1,782 @@
+#include "bf2c/interpreter.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bf2c/command.h"
+#include "bf2c/jit.h"
+#include "bf2c/options.h"
+#include "bf2c/program.h"
+#include "bf2c/source.h"
+#include "core/abort.h"
+#include "core/logging.h"
+#include "core/vector.h"
+
+// Dispatch by computed gotos (a GNU extension) where available, by a switch otherwise.
+#if defined(__GNUC__)
+#define BF2C_THREADED_CODE 1
+#endif
+
+enum {
+    // size of the input and the output buffer
+    IO_BUFFER_SIZE = 1 << 16,
+    // cells printed by DEBUG, as DBG_SIZE of the emitted program
+    DEBUG_CELLS = 31,
+    // "[%3u]" of a 32-bit cell
+    DEBUG_CELL_SIZE = 13,
+    // back-edges of a loop after which it is compiled by the tiered engine
+    HOT_LOOP_COUNT = 1000,
+    // commands of the longest superinstruction
+    MAX_SUPERINSTRUCTION_LENGTH = 4,
+};
+
+// Opcodes besides the command types
+enum {
+    // behind the commands, ends the program
+    OP_END = COMMAND_TYPE_UNKNOWN + 1,
+    // replaces the LOOP_START of a compiled loop, the offset is the index of its native code
+    OP_NATIVE,
+#define SUPERINSTRUCTION2(name, a, b)       OP_##name,
+#define SUPERINSTRUCTION3(name, a, b, c)    OP_##name,
+#define SUPERINSTRUCTION4(name, a, b, c, d) OP_##name,
+#include "superinstructions.def"
+#undef SUPERINSTRUCTION2
+#undef SUPERINSTRUCTION3
+#undef SUPERINSTRUCTION4
+    OP_COUNT
+};
+
+// Commands fused by a superinstruction
+typedef struct bf2c_superinstruction_t {
+    uint8_t type;
+    uint8_t length;
+    uint8_t commands[MAX_SUPERINSTRUCTION_LENGTH];
+} bf2c_superinstruction_t;
+
+static bf2c_superinstruction_t const superinstructions[] = {
+#define SUPERINSTRUCTION2(name, a, b)                                                              \
+    {OP_##name, 2, {COMMAND_TYPE_##a, COMMAND_TYPE_##b}},
+#define SUPERINSTRUCTION3(name, a, b, c)                                                           \
+    {OP_##name, 3, {COMMAND_TYPE_##a, COMMAND_TYPE_##b, COMMAND_TYPE_##c}},
+#define SUPERINSTRUCTION4(name, a, b, c, d)                                                        \
+    {OP_##name, 4, {COMMAND_TYPE_##a, COMMAND_TYPE_##b, COMMAND_TYPE_##c, COMMAND_TYPE_##d}},
+#include "superinstructions.def"
+#undef SUPERINSTRUCTION2
+#undef SUPERINSTRUCTION3
+#undef SUPERINSTRUCTION4
+};
+
+// Instruction of the threaded code
+typedef struct bf2c_instr_t {
+#ifdef BF2C_THREADED_CODE
+    void* label; // of the handler of the type
+#endif
+    int64_t value; // of the command, the distance to the matching command for loops
+    int32_t offset;
+    uint8_t type; // command_type_t or another opcode
+} bf2c_instr_t;
+
+#define JIT_CODE_CMP(a, b) TRIVIAL_COMP((a).memory, (b).memory)
+VECTOR_DECLARE_WITH_PREFIX(bf2c_jit_code_vec_t, bf2c_jit_code_vec, bf2c_jit_code_t, void)
+VECTOR_DEFINE_WITH_PREFIX(bf2c_jit_code_vec_t,
+                          bf2c_jit_code_vec,
+                          bf2c_jit_code_t,
+                          void,
+                          JIT_CODE_CMP)
+
+typedef struct bf2c_machine_t {
+    uint32_t* cells; // the tape, padded by the largest offset on both sides
+    size_t size;     // of the tape
+    uint32_t mask;   // of the cell width
+    bf2c_io_t io;
+    char* out;
+    size_t out_len;
+    char* in;
+    size_t in_pos;
+    size_t in_len;
+    // tiered execution, counts is NULL without it
+    program_t const* program;
+    bf2c_options_t const* options;
+    uint32_t* counts; // back-edges taken per LOOP_END
+    bf2c_jit_code_vec_t native;
+#ifdef BF2C_DISPATCH_STATS
+    uint64_t* executed;            // per command
+    uint64_t dispatches[OP_COUNT]; // per opcode
+#endif
+} bf2c_machine_t;
+
+static bool bf2c_machine_flush(bf2c_machine_t* machine) {
+    bool const success =
+        machine->out_len == 0 ||
+        machine->io.write(machine->io.write_context, machine->out, machine->out_len);
+    machine->out_len = 0;
+    return success;
+}
+
+static inline bool bf2c_machine_put(bf2c_machine_t* machine, char byte) {
+    if (machine->out_len == IO_BUFFER_SIZE && !bf2c_machine_flush(machine)) {
+        return false;
+    }
+    machine->out[machine->out_len++] = byte;
+    return true;
+}
+
+static bool bf2c_machine_put_all(bf2c_machine_t* machine, char const* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (!bf2c_machine_put(machine, data[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The output is written before waiting for input, e.g. for a prompt.
+static bool bf2c_machine_get(bf2c_machine_t* machine, uint32_t* cell) {
+    if (machine->in_pos == machine->in_len) {
+        if (!bf2c_machine_flush(machine)) {
+            return false;
+        }
+        machine->in_pos = 0;
+        machine->in_len = machine->io.read(machine->io.read_context, machine->in, IO_BUFFER_SIZE);
+        if (machine->in_len == 0) {
+            return true;
+        }
+    }
+    *cell = (unsigned char) machine->in[machine->in_pos++];
+    return true;
+}
+
+// Print the cells around idx like the debug function of the emitted program.
+static bool bf2c_machine_debug(bf2c_machine_t* machine, size_t idx) {
+    size_t const start = idx < DEBUG_CELLS / 2 || machine->size < DEBUG_CELLS ? 0
+                         : idx >= machine->size - DEBUG_CELLS / 2 ? machine->size - DEBUG_CELLS
+                                                                  : idx - DEBUG_CELLS / 2;
+    size_t const end = start + DEBUG_CELLS < machine->size ? start + DEBUG_CELLS : machine->size;
+    bool success     = bf2c_machine_put(machine, '\n');
+    for (size_t i = start; success && i < end; ++i) {
+        char cell[DEBUG_CELL_SIZE + 1];
+        int const length =
+            snprintf(cell, sizeof(cell), "[%3lu]", (unsigned long) machine->cells[i]);
+        success          = length > 0 && bf2c_machine_put_all(machine, cell, (size_t) length);
+    }
+    return success && bf2c_machine_put(machine, '\n');
+}
+
+// Callbacks of the JIT compiled code
+static bool bf2c_jit_put(void* io, uint32_t value) {
+    return bf2c_machine_put((bf2c_machine_t*) io, (char) value);
+}
+
+static bool bf2c_jit_get(void* io, uint32_t* cell) {
+    return bf2c_machine_get((bf2c_machine_t*) io, cell);
+}
+
+static bool bf2c_jit_debug(void* io, uint32_t const* cell) {
+    bf2c_machine_t* machine = (bf2c_machine_t*) io;
+    return bf2c_machine_debug(machine, (size_t) (cell - machine->cells));
+}
+
+// Run native code from idx and update idx. If it leaves the tape, `command` is the index of the
+// command which did.
+static bf2c_jit_status_t bf2c_machine_run_native(bf2c_machine_t* machine,
+                                                 bf2c_jit_code_t const* code,
+                                                 size_t* idx,
+                                                 size_t* command) {
+    bf2c_jit_context_t context = {
+        .cell  = machine->cells + *idx,
+        .begin = machine->cells,
+        .end   = machine->cells + machine->size,
+        .io    = machine,
+        .put   = bf2c_jit_put,
+        .get   = bf2c_jit_get,
+        .debug = bf2c_jit_debug,
+    };
+    bf2c_jit_status_t const status = bf2c_jit_run(code, &context);
+    *idx                           = (size_t) (context.cell - machine->cells);
+    *command                       = context.command;
+    return status;
+}
+
+// Compile the loop ending at `end` and replace its LOOP_START by OP_NATIVE.
+// Returns false if it cannot be compiled.
+static bool bf2c_machine_promote(bf2c_machine_t* machine, bf2c_instr_t* code, size_t end) {
+    size_t const start   = (size_t) ((int64_t) end + code[end].value);
+    bf2c_jit_code_t loop = {0};
+    if (machine->native.size >= INT32_MAX ||
+        !bf2c_jit_compile(machine->program, start, end + 1, machine->options, &loop)) {
+        return false;
+    }
+    LOG_DEBUG("Compiled the loop of the commands %zu to %zu", start, end);
+    code[start].type   = OP_NATIVE;
+    code[start].offset = (int32_t) machine->native.size;
+    bf2c_jit_code_vec_push_back(&machine->native, loop);
+    return true;
+}
+
+#ifdef BF2C_DISPATCH_STATS
+#define COUNT_DISPATCH() ++machine->dispatches[ip->type]
+#define COUNT_COMMAND()  ++machine->executed[ip - code]
+#else
+#define COUNT_DISPATCH() (void) 0
+#define COUNT_COMMAND()  (void) 0
+#endif
+
+#ifdef BF2C_THREADED_CODE
+#define OP(label, type) label:
+#define NEXT()                                                                                     \
+    do {                                                                                           \
+        ++ip;                                                                                      \
+        COUNT_DISPATCH();                                                                          \
+        goto* ip->label;                                                                           \
+    } while (0)
+#define SET_NATIVE_LABEL(instr) (instr).label = labels[OP_NATIVE]
+// labels as values are not ISO C
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#else
+#define OP(label, type) case type:
+#define NEXT()          continue
+#define SET_NATIVE_LABEL(instr) (void) 0
+#endif
+
+// Bodies of the commands, shared by their handlers and the superinstructions. They are blocks
+// instead of do-while statements, as NEXT() continues the dispatch loop of the switch. A body which
+// jumps dispatches the target, otherwise the next command follows.
+#define BODY_CHANGE_VAL()                                                                          \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        cell  = cells + idx + ip->offset;                                                          \
+        *cell = (*cell + (uint32_t) ip->value) & mask;                                             \
+    }
+#define BODY_CHANGE_PTR()                                                                          \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        idx += (size_t) ip->value; /* negative values wrap around */                              \
+        if (idx >= size) {                                                                         \
+            goto out_of_tape;                                                                      \
+        }                                                                                          \
+    }
+#define BODY_OUT()                                                                                 \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        if (!bf2c_machine_put(machine, (char) cells[idx])) {                                       \
+            goto io_error;                                                                         \
+        }                                                                                          \
+    }
+#define BODY_IN()                                                                                  \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        if (!bf2c_machine_get(machine, &cells[idx])) {                                             \
+            goto io_error;                                                                         \
+        }                                                                                          \
+    }
+#define BODY_LOOP_START()                                                                          \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        if (cells[idx] == 0) {                                                                     \
+            ip += ip->value;                                                                       \
+            NEXT();                                                                                \
+        }                                                                                          \
+    }
+// With tiered execution, the LOOP_END of a loop which is hot compiles it, the current iteration
+// continues as native code from the head of the loop and so does every later execution of it.
+#define BODY_LOOP_END()                                                                            \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        if (cells[idx] != 0) {                                                                     \
+            size_t const end = (size_t) (ip - code);                                               \
+            if (machine->counts && ++machine->counts[end] == HOT_LOOP_COUNT &&                     \
+                bf2c_machine_promote(machine, code, end)) {                                        \
+                SET_NATIVE_LABEL(code[(int64_t) end + ip->value]);                                 \
+                status = bf2c_machine_run_native(machine,                                          \
+                                                 &machine->native.data[machine->native.size - 1],  \
+                                                 &idx,                                             \
+                                                 &native_command);                                 \
+                if (status != BF2C_JIT_DONE) {                                                     \
+                    goto native_error;                                                             \
+                }                                                                                  \
+                NEXT();                                                                            \
+            }                                                                                      \
+            ip += ip->value;                                                                       \
+            NEXT();                                                                                \
+        }                                                                                          \
+    }
+#define BODY_DEBUG()                                                                               \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        if (!bf2c_machine_debug(machine, idx)) {                                                   \
+            goto io_error;                                                                         \
+        }                                                                                          \
+    }
+#define BODY_SET()                                                                                 \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        cell  = cells + idx + ip->offset;                                                          \
+        *cell = (uint32_t) ip->value & mask;                                                       \
+    }
+#define BODY_MUL()                                                                                 \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        cell  = cells + idx + ip->offset;                                                          \
+        *cell = (*cell + (uint32_t) ip->value * cells[idx]) & mask;                                \
+    }
+#define BODY_SCAN()                                                                                \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        while (cells[idx] != 0) {                                                                  \
+            idx += (size_t) ip->value;                                                             \
+            if (idx >= size) {                                                                     \
+                goto out_of_tape;                                                                  \
+            }                                                                                      \
+        }                                                                                          \
+    }
+#define BODY_WRITE()                                                                               \
+    {                                                                                              \
+        COUNT_COMMAND();                                                                           \
+        if (!bf2c_machine_put(machine, (char) ip->value)) {                                        \
+            goto io_error;                                                                         \
+        }                                                                                          \
+    }
+#define BODY_UNKNOWN() COUNT_COMMAND()
+
+// Run the code from idx until OP_END.
+static bool bf2c_machine_run(bf2c_machine_t* machine, bf2c_instr_t* code, size_t idx) {
+    uint32_t* const cells    = machine->cells;
+    size_t const size        = machine->size;
+    uint32_t const mask      = machine->mask;
+    bf2c_instr_t const* ip   = code;
+    uint32_t* cell           = NULL;
+    bf2c_jit_status_t status = BF2C_JIT_DONE;
+    size_t native_command    = 0; // which left the tape
+#ifdef BF2C_THREADED_CODE
+    static void* const labels[] = {
+        [COMMAND_TYPE_CHANGE_VAL] = &&op_change_val,
+        [COMMAND_TYPE_CHANGE_PTR] = &&op_change_ptr,
+        [COMMAND_TYPE_OUT]        = &&op_out,
+        [COMMAND_TYPE_IN]         = &&op_in,
+        [COMMAND_TYPE_LOOP_START] = &&op_loop_start,
+        [COMMAND_TYPE_LOOP_END]   = &&op_loop_end,
+        [COMMAND_TYPE_DEBUG]      = &&op_debug,
+        [COMMAND_TYPE_SET]        = &&op_set,
+        [COMMAND_TYPE_MUL]        = &&op_mul,
+        [COMMAND_TYPE_SCAN]       = &&op_scan,
+        [COMMAND_TYPE_WRITE]      = &&op_write,
+        [COMMAND_TYPE_UNKNOWN]    = &&op_unknown,
+        [OP_END]                  = &&op_end,
+        [OP_NATIVE]               = &&op_native,
+#define SUPERINSTRUCTION2(name, a, b)       [OP_##name] = &&op_##name,
+#define SUPERINSTRUCTION3(name, a, b, c)    [OP_##name] = &&op_##name,
+#define SUPERINSTRUCTION4(name, a, b, c, d) [OP_##name] = &&op_##name,
+#include "superinstructions.def"
+#undef SUPERINSTRUCTION2
+#undef SUPERINSTRUCTION3
+#undef SUPERINSTRUCTION4
+    };
+    bf2c_instr_t* instr = code;
+    for (; instr->type != OP_END; ++instr) {
+        instr->label = labels[instr->type];
+    }
+    instr->label = labels[OP_END];
+    COUNT_DISPATCH();
+    goto* ip->label;
+#else
+    for (;; ++ip) {
+        COUNT_DISPATCH();
+        switch (ip->type) {
+#endif
+    OP(op_change_val, COMMAND_TYPE_CHANGE_VAL) {
+        BODY_CHANGE_VAL();
+        NEXT();
+    }
+    OP(op_change_ptr, COMMAND_TYPE_CHANGE_PTR) {
+        BODY_CHANGE_PTR();
+        NEXT();
+    }
+    OP(op_out, COMMAND_TYPE_OUT) {
+        BODY_OUT();
+        NEXT();
+    }
+    OP(op_in, COMMAND_TYPE_IN) {
+        BODY_IN();
+        NEXT();
+    }
+    OP(op_loop_start, COMMAND_TYPE_LOOP_START) {
+        BODY_LOOP_START();
+        NEXT();
+    }
+    OP(op_loop_end, COMMAND_TYPE_LOOP_END) {
+        BODY_LOOP_END();
+        NEXT();
+    }
+    OP(op_native, OP_NATIVE) {
+        status = bf2c_machine_run_native(
+            machine, &machine->native.data[ip->offset], &idx, &native_command);
+        if (status != BF2C_JIT_DONE) {
+            goto native_error;
+        }
+        ip += ip->value; // the LOOP_END, the loop is done
+        NEXT();
+    }
+    OP(op_debug, COMMAND_TYPE_DEBUG) {
+        BODY_DEBUG();
+        NEXT();
+    }
+    OP(op_set, COMMAND_TYPE_SET) {
+        BODY_SET();
+        NEXT();
+    }
+    OP(op_mul, COMMAND_TYPE_MUL) {
+        BODY_MUL();
+        NEXT();
+    }
+    OP(op_scan, COMMAND_TYPE_SCAN) {
+        BODY_SCAN();
+        NEXT();
+    }
+    OP(op_write, COMMAND_TYPE_WRITE) {
+        BODY_WRITE();
+        NEXT();
+    }
+    OP(op_unknown, COMMAND_TYPE_UNKNOWN) {
+        BODY_UNKNOWN();
+        NEXT();
+    }
+    // The commands of a superinstruction are executed in order, ip points to the current one.
+#define SUPERINSTRUCTION2(name, a, b)                                                              \
+    OP(op_##name, OP_##name) {                                                                     \
+        BODY_##a();                                                                                \
+        ++ip;                                                                                      \
+        BODY_##b();                                                                                \
+        NEXT();                                                                                    \
+    }
+#define SUPERINSTRUCTION3(name, a, b, c)                                                           \
+    OP(op_##name, OP_##name) {                                                                     \
+        BODY_##a();                                                                                \
+        ++ip;                                                                                      \
+        BODY_##b();                                                                                \
+        ++ip;                                                                                      \
+        BODY_##c();                                                                                \
+        NEXT();                                                                                    \
+    }
+#define SUPERINSTRUCTION4(name, a, b, c, d)                                                        \
+    OP(op_##name, OP_##name) {                                                                     \
+        BODY_##a();                                                                                \
+        ++ip;                                                                                      \
+        BODY_##b();                                                                                \
+        ++ip;                                                                                      \
+        BODY_##c();                                                                                \
+        ++ip;                                                                                      \
+        BODY_##d();                                                                                \
+        NEXT();                                                                                    \
+    }
+#include "superinstructions.def"
+#undef SUPERINSTRUCTION2
+#undef SUPERINSTRUCTION3
+#undef SUPERINSTRUCTION4
+    OP(op_end, OP_END) {
+        if (!bf2c_machine_flush(machine)) {
+            goto io_error;
+        }
+        return true;
+    }
+#ifndef BF2C_THREADED_CODE
+            default: LOG_MSG_AND_ABORT("Unknown instruction.");
+        }
+    }
+#endif
+
+native_error:
+    if (status == BF2C_JIT_IO_ERROR) {
+        goto io_error;
+    }
+    ip = code + native_command;
+out_of_tape:
+    LOG_ERROR("The pointer left the tape at command %zu.", (size_t) (ip - code));
+    (void) bf2c_machine_flush(machine);
+    return false;
+io_error:
+    LOG_ERROR_MSG("Failed to write the output.");
+    return false;
+}
+
+#ifdef BF2C_THREADED_CODE
+#pragma GCC diagnostic pop
+#endif
+#undef OP
+#undef NEXT
+#undef SET_NATIVE_LABEL
+#undef COUNT_DISPATCH
+#undef COUNT_COMMAND
+
+// Replace the type of every instruction which starts a superinstruction by the longest one. The
+// fused instructions keep their types and operands, the superinstruction executes them and loops
+// may still jump to them.
+static void bf2c_fuse(bf2c_instr_t* code, command_vec_t const* commands) {
+    size_t const count = sizeof(superinstructions) / sizeof(superinstructions[0]);
+    for (size_t i = 0; i < commands->size; ++i) {
+        size_t longest = 0;
+        for (size_t j = 0; j < count; ++j) {
+            bf2c_superinstruction_t const* super = &superinstructions[j];
+            if (super->length > longest && super->length <= commands->size - i &&
+                memcmp(commands->types + i, super->commands, super->length) == 0) {
+                longest      = super->length;
+                code[i].type = super->type;
+            }
+        }
+    }
+}
+
+// Translate the commands to instructions, followed by OP_END.
+static bf2c_instr_t* bf2c_translate(program_t const* program, size_t* max_offset) {
+    command_vec_t const* commands = &program->commands;
+    bf2c_instr_t* code            = malloc((commands->size + 1) * sizeof(bf2c_instr_t));
+    LOG_MSG_AND_ABORT_IF(!code, "Failed to allocate code.");
+    *max_offset = 0;
+    COMMAND_VEC_FOR_EACH (cmd, *commands) {
+        bool const is_loop =
+            cmd.type == COMMAND_TYPE_LOOP_START || cmd.type == COMMAND_TYPE_LOOP_END;
+        code[cmd_iterator] = (bf2c_instr_t){
+            .value  = is_loop ? bf2c_program_loop_delta(program, cmd_iterator) : cmd.value,
+            .offset = cmd.offset,
+            .type   = (uint8_t) cmd.type,
+        };
+        size_t const distance = cmd.offset < 0 ? 0U - (size_t) cmd.offset : (size_t) cmd.offset;
+        *max_offset           = distance > *max_offset ? distance : *max_offset;
+    }
+    code[commands->size] = (bf2c_instr_t){.type = OP_END};
+    bf2c_fuse(code, commands);
+    return code;
+}
+
+#ifdef BF2C_DISPATCH_STATS
+enum {
+    // sequences of command types are packed into 4 bits per command, below their length
+    STATS_TYPE_BITS = 4,
+    STATS_SEQUENCES = (MAX_SUPERINSTRUCTION_LENGTH + 1)
+                      << (STATS_TYPE_BITS * MAX_SUPERINSTRUCTION_LENGTH),
+    // candidates which are printed
+    STATS_CANDIDATES = 16,
+};
+
+typedef struct bf2c_candidate_t {
+    uint64_t saved; // dispatches
+    size_t sequence;
+} bf2c_candidate_t;
+
+static int bf2c_candidate_compare(void const* a, void const* b) {
+    uint64_t const lhs = ((bf2c_candidate_t const*) a)->saved;
+    uint64_t const rhs = ((bf2c_candidate_t const*) b)->saved;
+    return lhs < rhs ? 1 : lhs > rhs ? -1 : 0;
+}
+
+static char const* bf2c_opcode_name(size_t opcode) {
+    static char const* const names[] = {
+        [OP_END]    = "END",
+        [OP_NATIVE] = "NATIVE",
+#define SUPERINSTRUCTION2(name, a, b)       [OP_##name] = #name,
+#define SUPERINSTRUCTION3(name, a, b, c)    [OP_##name] = #name,
+#define SUPERINSTRUCTION4(name, a, b, c, d) [OP_##name] = #name,
+#include "superinstructions.def"
+#undef SUPERINSTRUCTION2
+#undef SUPERINSTRUCTION3
+#undef SUPERINSTRUCTION4
+    };
+    return opcode < OP_END ? bf2c_command_type_to_string((command_type_t) opcode) : names[opcode];
+}
+
+// Print a packed sequence as entry of superinstructions.def.
+static void bf2c_print_sequence(size_t sequence, uint64_t saved, FILE* file) {
+    static char const* const short_names[] = {
+        [COMMAND_TYPE_CHANGE_VAL] = "VAL",   [COMMAND_TYPE_CHANGE_PTR] = "PTR",
+        [COMMAND_TYPE_OUT]        = "OUT",   [COMMAND_TYPE_IN]         = "IN",
+        [COMMAND_TYPE_LOOP_START] = "OPEN",  [COMMAND_TYPE_LOOP_END]   = "CLOSE",
+        [COMMAND_TYPE_DEBUG]      = "DEBUG", [COMMAND_TYPE_SET]        = "SET",
+        [COMMAND_TYPE_MUL]        = "MUL",   [COMMAND_TYPE_SCAN]       = "SCAN",
+        [COMMAND_TYPE_WRITE]      = "WRITE", [COMMAND_TYPE_UNKNOWN]    = "UNKNOWN",
+    };
+    size_t const length = sequence >> (STATS_TYPE_BITS * MAX_SUPERINSTRUCTION_LENGTH);
+    size_t const mask   = (1U << STATS_TYPE_BITS) - 1;
+    (void) fprintf(file, "SUPERINSTRUCTION%zu(", length);
+    for (size_t i = 0; i < length; ++i) {
+        size_t const type = sequence >> (STATS_TYPE_BITS * i) & mask;
+        (void) fprintf(file, "%s%s", i > 0 ? "_" : "", short_names[type]);
+    }
+    for (size_t i = 0; i < length; ++i) {
+        size_t const type = sequence >> (STATS_TYPE_BITS * i) & mask;
+        (void) fprintf(file, ", %s", bf2c_command_type_to_string((command_type_t) type));
+    }
+    (void) fprintf(file, ") // saves %" PRIu64 " dispatches\n", saved);
+}
+
+// Print the dispatches per opcode, the commands, which an interpreter without superinstructions
+// dispatches, and the sequences of commands which would save the most dispatches as entries of
+// superinstructions.def. A sequence is expected to run as often as its least executed command.
+static void bf2c_machine_print_stats(bf2c_machine_t const* machine,
+                                     command_vec_t const* commands,
+                                     FILE* file) {
+    uint64_t executed   = 0;
+    uint64_t dispatches = 0;
+    (void) fprintf(file, "%-24s %16s\n", "opcode", "dispatches");
+    for (size_t op = 0; op < OP_COUNT; ++op) {
+        if (machine->dispatches[op] > 0) {
+            (void) fprintf(
+                file, "%-24s %16" PRIu64 "\n", bf2c_opcode_name(op), machine->dispatches[op]);
+        }
+        dispatches += machine->dispatches[op];
+    }
+    uint64_t* saved = calloc(STATS_SEQUENCES, sizeof(uint64_t));
+    LOG_MSG_AND_ABORT_IF(!saved, "Failed to allocate statistics.");
+    for (size_t i = 0; i < commands->size; ++i) {
+        executed      += machine->executed[i];
+        uint64_t runs  = machine->executed[i];
+        size_t packed  = commands->types[i];
+        for (size_t length = 2;
+             length <= MAX_SUPERINSTRUCTION_LENGTH && i + length <= commands->size;
+             ++length) {
+            size_t const last = i + length - 1;
+            if (commands->types[last] == COMMAND_TYPE_LOOP_START) {
+                break;
+            }
+            runs    = machine->executed[last] < runs ? machine->executed[last] : runs;
+            packed |= (size_t) commands->types[last] << (STATS_TYPE_BITS * (length - 1));
+            saved[length << (STATS_TYPE_BITS * MAX_SUPERINSTRUCTION_LENGTH) | packed] +=
+                runs * (length - 1);
+        }
+    }
+    (void) fprintf(file, "%-24s %16" PRIu64 "\n", "commands", executed);
+    (void) fprintf(file, "%-24s %16" PRIu64 "\n", "dispatches", dispatches);
+    // the best candidates in descending order, the last one is the next to be sorted in
+    bf2c_candidate_t candidates[STATS_CANDIDATES + 1] = {{0}};
+    for (size_t sequence = 0; sequence < STATS_SEQUENCES; ++sequence) {
+        if (saved[sequence] > candidates[STATS_CANDIDATES - 1].saved) {
+            candidates[STATS_CANDIDATES] = (bf2c_candidate_t){saved[sequence], sequence};
+            qsort(candidates, STATS_CANDIDATES + 1, sizeof(*candidates), bf2c_candidate_compare);
+        }
+    }
+    free(saved);
+    for (size_t i = 0; i < STATS_CANDIDATES && candidates[i].saved > 0; ++i) {
+        bf2c_print_sequence(candidates[i].sequence, candidates[i].saved, file);
+    }
+}
+#endif
+
+bool bf2c_execute(program_t const* program, bf2c_options_t const* options, bf2c_io_t io) {
+    ABORT_IF(!program || !options || !io.read || !io.write);
+    program_state_t const* state = &program->state;
+    if (!bf2c_options_are_valid(options)) {
+        LOG_ERROR("Invalid tape: %zu cells of %u bits", options->tape_size, options->cell_bits);
+        return false;
+    }
+    if (state->cells.size > options->tape_size || state->index >= options->tape_size) {
+        LOG_ERROR("The state does not fit on a tape of %zu cells.", options->tape_size);
+        return false;
+    }
+    size_t padding     = 0;
+    bf2c_instr_t* code = bf2c_translate(program, &padding);
+    // Cells at an offset from idx are accessed without a bounds check, only idx is checked.
+    uint32_t* tape = calloc(options->tape_size + 2 * padding, sizeof(uint32_t));
+    char* buffers  = malloc(2 * IO_BUFFER_SIZE);
+    LOG_MSG_AND_ABORT_IF(!tape || !buffers, "Failed to allocate tape.");
+    bf2c_machine_t machine = {
+        .cells = tape + padding,
+        .size  = options->tape_size,
+        .mask  = bf2c_options_cell_mask(options),
+        .io    = io,
+        .out   = buffers,
+        .in    = buffers + IO_BUFFER_SIZE,
+    };
+    for (size_t i = 0; i < state->cells.size; ++i) {
+        machine.cells[i] = (uint32_t) state->cells.data[i] & machine.mask;
+    }
+    bool success = bf2c_machine_put_all(&machine, state->output.data, state->output.size);
+    bf2c_jit_code_t native = {0};
+    if (success && options->engine == BF2C_ENGINE_JIT && bf2c_jit_is_supported() &&
+        program->commands.size > 0) {
+        if (bf2c_jit_compile(program, 0, program->commands.size, options, &native)) {
+            // the whole program is a single native "loop"
+            code[0]     = (bf2c_instr_t){.value = (int64_t) program->commands.size - 1,
+                                         .type  = OP_NATIVE};
+            machine.native = bf2c_jit_code_vec_create();
+            bf2c_jit_code_vec_push_back(&machine.native, native);
+        } else {
+            LOG_DEBUG_MSG("The program cannot be compiled, it is interpreted.");
+        }
+    }
+    if (options->engine == BF2C_ENGINE_TIERED && bf2c_jit_is_supported()) {
+        machine.program = program;
+        machine.options = options;
+        machine.counts  = calloc(program->commands.size + 1, sizeof(uint32_t));
+        machine.native  = bf2c_jit_code_vec_create();
+        LOG_MSG_AND_ABORT_IF(!machine.counts, "Failed to allocate loop counters.");
+    }
+#ifdef BF2C_DISPATCH_STATS
+    machine.executed = calloc(program->commands.size + 1, sizeof(uint64_t));
+    LOG_MSG_AND_ABORT_IF(!machine.executed, "Failed to allocate statistics.");
+#endif
+    success = success && bf2c_machine_run(&machine, code, state->index);
+#ifdef BF2C_DISPATCH_STATS
+    bf2c_machine_print_stats(&machine, &program->commands, stderr);
+    free(machine.executed);
+#endif
+    VEC_FOR_EACH (bf2c_jit_code_t, loop, machine.native) {
+        bf2c_jit_destroy(&loop);
+    }
+    bf2c_jit_code_vec_destroy(&machine.native);
+    free(machine.counts);
+    free(buffers);
+    free(tape);
+    free(code);
+    return success;
+}
+
+static size_t bf2c_io_file_read(void* context, char* buffer, size_t size) {
+    bool error         = false;
+    size_t const count = bf2c_source_read_block((FILE*) context, buffer, size, &error);
+    if (error) {
+        LOG_ERROR_MSG("Error reading input");
+    }
+    return count;
+}
+
+static bool bf2c_io_file_write(void* context, char const* data, size_t size) {
+    FILE* file = (FILE*) context;
+    return fwrite(data, 1, size, file) == size && fflush(file) == 0;
+}
+
+bf2c_io_t bf2c_io_from_files(FILE* input, FILE* output) {
+    ABORT_IF(!input || !output);
+    return (bf2c_io_t){bf2c_io_file_read, input, bf2c_io_file_write, output};
+}
+
+static size_t bf2c_io_memory_read(void* context, char* buffer, size_t size) {
+    bf2c_io_memory_t* memory = (bf2c_io_memory_t*) context;
+    size_t const count       = size < memory->input_size ? size : memory->input_size;
+    if (count > 0) {
+        memcpy(buffer, memory->input, count);
+    }
+    memory->input += count;
+    memory->input_size -= count;
+    return count;
+}
+
+static bool bf2c_io_memory_write(void* context, char const* data, size_t size) {
+    core_vec_char_t* output = &((bf2c_io_memory_t*) context)->output;
+    if (output->capacity - output->size < size) {
+        size_t const needed  = output->size + size;
+        size_t const doubled = 2 * output->capacity;
+        core_vec_char_reserve(output, needed > doubled ? needed : doubled);
+    }
+    memcpy(output->data + output->size, data, size);
+    output->size += size;
+    return true;
+}
+
+bf2c_io_t bf2c_io_from_memory(bf2c_io_memory_t* memory) {
+    ABORT_IF(!memory);
+    return (bf2c_io_t){bf2c_io_memory_read, memory, bf2c_io_memory_write, memory};
+}
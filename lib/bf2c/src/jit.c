@@ -0,0 +1,387 @@
+#include "bf2c/jit.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bf2c/command.h"
+#include "bf2c/options.h"
+#include "bf2c/program.h"
+#include "core/abort.h"
+#include "core/logging.h"
+#include "core/vector.h"
+
+#if defined(__x86_64__) && !defined(_WIN32) && defined(BF2C_HAVE_MMAP)
+#include <sys/mman.h>
+#define BF2C_JIT_X86_64 1
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+bool bf2c_jit_is_supported(void) {
+#ifdef BF2C_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef BF2C_JIT_X86_64
+
+// Registers of the code
+//   rbx: pointer to the current cell
+//   r12, r13: begin and end of the tape
+//   r14: io of the callbacks
+//   r15: the context
+// All of them are callee-saved, so they survive the calls of the callbacks.
+
+// Machine code being assembled, the jumps to the exits are patched at the end.
+typedef struct bf2c_asm_t {
+    core_vec_char_t code;
+    core_vec_size_t out_of_tape; // positions of rel32 jumping to the exit with that status
+    core_vec_size_t out_of_tape_commands; // the command of each of them
+    core_vec_size_t io_error;
+    size_t command; // index of the command being assembled
+    bool failed;    // an operand does not fit
+} bf2c_asm_t;
+
+#define ASM(assembler, ...)                                                                        \
+    do {                                                                                           \
+        uint8_t const bytes_[] = {__VA_ARGS__};                                                    \
+        bf2c_asm_bytes((assembler), bytes_, sizeof(bytes_));                                       \
+    } while (0)
+
+static void bf2c_asm_bytes(bf2c_asm_t* assembler, uint8_t const* bytes, size_t size) {
+    core_vec_char_t* code = &assembler->code;
+    if (code->capacity - code->size < size) {
+        size_t const needed  = code->size + size;
+        size_t const doubled = 2 * code->capacity;
+        core_vec_char_reserve(code, needed > doubled ? needed : doubled);
+    }
+    memcpy(code->data + code->size, bytes, size);
+    code->size += size;
+}
+
+static void bf2c_asm_u32(bf2c_asm_t* assembler, uint32_t value) {
+    ASM(assembler,
+        (uint8_t) value,
+        (uint8_t) (value >> 8),
+        (uint8_t) (value >> 16),
+        (uint8_t) (value >> 24));
+}
+
+// Immediate operand of the cell width
+static void bf2c_asm_imm(bf2c_asm_t* assembler, unsigned bits, uint32_t value) {
+    if (bits == 8) {
+        ASM(assembler, (uint8_t) value);
+    } else if (bits == 16) {
+        ASM(assembler, (uint8_t) value, (uint8_t) (value >> 8));
+    } else {
+        bf2c_asm_u32(assembler, value);
+    }
+}
+
+// Opcode of the cell width, words take the operand size prefix.
+static void bf2c_asm_op(bf2c_asm_t* assembler, unsigned bits, uint8_t op8, uint8_t op) {
+    if (bits == 16) {
+        ASM(assembler, 0x66);
+    }
+    ASM(assembler, bits == 8 ? op8 : op);
+}
+
+// ModRM (and displacement) of the cell at `offset` from rbx, `reg` is the register or the opcode
+// extension.
+static void bf2c_asm_cell(bf2c_asm_t* assembler, unsigned reg, int32_t offset) {
+    int64_t const disp = (int64_t) offset * (int64_t) sizeof(uint32_t);
+    if (disp == 0) {
+        ASM(assembler, (uint8_t) (reg << 3 | 3));
+    } else if (disp >= INT8_MIN && disp <= INT8_MAX) {
+        ASM(assembler, (uint8_t) (0x40 | reg << 3 | 3), (uint8_t) disp);
+    } else if (disp >= INT32_MIN && disp <= INT32_MAX) {
+        ASM(assembler, (uint8_t) (0x80 | reg << 3 | 3));
+        bf2c_asm_u32(assembler, (uint32_t) disp);
+    } else {
+        assembler->failed = true;
+    }
+}
+
+// Placeholder of a rel32 operand, returns its position.
+static size_t bf2c_asm_rel32(bf2c_asm_t* assembler) {
+    size_t const position = assembler->code.size;
+    bf2c_asm_u32(assembler, 0);
+    return position;
+}
+
+static void bf2c_asm_patch(bf2c_asm_t* assembler, size_t position, size_t target) {
+    int64_t const rel    = (int64_t) target - (int64_t) (position + 4);
+    uint32_t const value = (uint32_t) rel;
+    char* const out      = assembler->code.data + position;
+    out[0]               = (char) (uint8_t) value;
+    out[1]               = (char) (uint8_t) (value >> 8);
+    out[2]               = (char) (uint8_t) (value >> 16);
+    out[3]               = (char) (uint8_t) (value >> 24);
+}
+
+// cmp dword [rbx], 0 (the upper bits of the cells are zero)
+static void bf2c_asm_test_cell(bf2c_asm_t* assembler) {
+    ASM(assembler, 0x83, 0x3B, 0x00);
+}
+
+// Move rbx by `value` cells and leave if it is not on the tape any more.
+static void bf2c_asm_move(bf2c_asm_t* assembler, int64_t value) {
+    int64_t const bytes = value * (int64_t) sizeof(uint32_t);
+    if (bytes < INT32_MIN || bytes > INT32_MAX) {
+        assembler->failed = true;
+        return;
+    }
+    if (bytes >= INT8_MIN && bytes <= INT8_MAX) {
+        ASM(assembler, 0x48, 0x83, 0xC3, (uint8_t) bytes); // add rbx, imm8
+    } else {
+        ASM(assembler, 0x48, 0x81, 0xC3); // add rbx, imm32
+        bf2c_asm_u32(assembler, (uint32_t) bytes);
+    }
+    if (value < 0) {
+        ASM(assembler, 0x4C, 0x39, 0xE3, 0x0F, 0x82); // cmp rbx, r12; jb
+    } else {
+        ASM(assembler, 0x4C, 0x39, 0xEB, 0x0F, 0x83); // cmp rbx, r13; jae
+    }
+    core_vec_size_push_back(&assembler->out_of_tape, bf2c_asm_rel32(assembler));
+    core_vec_size_push_back(&assembler->out_of_tape_commands, assembler->command);
+}
+
+// Call the callback at `field` of the context with io and the current cell (or `value`) and leave
+// if it fails.
+static void bf2c_asm_call(bf2c_asm_t* assembler,
+                          size_t field,
+                          uint8_t const* argument,
+                          size_t size) {
+    ASM(assembler, 0x4C, 0x89, 0xF7); // mov rdi, r14
+    bf2c_asm_bytes(assembler, argument, size);
+    ASM(assembler, 0x41, 0xFF, 0x57, (uint8_t) field); // call [r15 + field]
+    ASM(assembler, 0x84, 0xC0, 0x0F, 0x84);            // test al, al; je
+    core_vec_size_push_back(&assembler->io_error, bf2c_asm_rel32(assembler));
+}
+
+static void bf2c_asm_command(bf2c_asm_t* assembler,
+                             command_t command,
+                             int64_t loop_delta,
+                             size_t* loop_positions,
+                             size_t index,
+                             unsigned bits) {
+    uint32_t const mask = bits >= 32 ? UINT32_MAX : (1U << bits) - 1U;
+    switch (command.type) {
+        case COMMAND_TYPE_CHANGE_VAL:
+            if (((uint32_t) command.value & mask) != 0) {
+                bf2c_asm_op(assembler, bits, 0x80, 0x81); // add [cell], imm
+                bf2c_asm_cell(assembler, 0, command.offset);
+                bf2c_asm_imm(assembler, bits, (uint32_t) command.value);
+            }
+            break;
+        case COMMAND_TYPE_SET:
+            bf2c_asm_op(assembler, bits, 0xC6, 0xC7); // mov [cell], imm
+            bf2c_asm_cell(assembler, 0, command.offset);
+            bf2c_asm_imm(assembler, bits, (uint32_t) command.value);
+            break;
+        case COMMAND_TYPE_MUL:
+            if (bits == 8) {
+                ASM(assembler, 0x0F, 0xB6, 0x03); // movzx eax, byte [rbx]
+            } else if (bits == 16) {
+                ASM(assembler, 0x0F, 0xB7, 0x03); // movzx eax, word [rbx]
+            } else {
+                ASM(assembler, 0x8B, 0x03); // mov eax, [rbx]
+            }
+            if (command.value == -1) {
+                ASM(assembler, 0xF7, 0xD8); // neg eax
+            } else if (command.value != 1) {
+                ASM(assembler, 0x69, 0xC0); // imul eax, eax, imm32
+                bf2c_asm_u32(assembler, (uint32_t) command.value);
+            }
+            bf2c_asm_op(assembler, bits, 0x00, 0x01); // add [cell], al/ax/eax
+            bf2c_asm_cell(assembler, 0, command.offset);
+            break;
+        case COMMAND_TYPE_CHANGE_PTR: bf2c_asm_move(assembler, command.value); break;
+        case COMMAND_TYPE_SCAN: {
+            size_t const top = assembler->code.size;
+            bf2c_asm_test_cell(assembler);
+            ASM(assembler, 0x0F, 0x84); // je
+            size_t const done = bf2c_asm_rel32(assembler);
+            bf2c_asm_move(assembler, command.value);
+            ASM(assembler, 0xE9); // jmp
+            bf2c_asm_patch(assembler, bf2c_asm_rel32(assembler), top);
+            bf2c_asm_patch(assembler, done, assembler->code.size);
+            break;
+        }
+        case COMMAND_TYPE_LOOP_START:
+            bf2c_asm_test_cell(assembler);
+            ASM(assembler, 0x0F, 0x84); // je, patched at the end of the loop
+            loop_positions[index] = bf2c_asm_rel32(assembler);
+            break;
+        case COMMAND_TYPE_LOOP_END: {
+            size_t const start = loop_positions[(size_t) ((int64_t) index + loop_delta)];
+            bf2c_asm_test_cell(assembler);
+            ASM(assembler, 0x0F, 0x85); // jne behind the start of the loop
+            bf2c_asm_patch(assembler, bf2c_asm_rel32(assembler), start + 4);
+            bf2c_asm_patch(assembler, start, assembler->code.size);
+            break;
+        }
+        case COMMAND_TYPE_OUT: {
+            uint8_t const argument[] = {0x8B, 0x33}; // mov esi, [rbx]
+            bf2c_asm_call(
+                assembler, offsetof(bf2c_jit_context_t, put), argument, sizeof(argument));
+            break;
+        }
+        case COMMAND_TYPE_WRITE: {
+            uint8_t const byte       = (uint8_t) command.value;
+            uint8_t const argument[] = {0xBE, byte, 0, 0, 0}; // mov esi, imm32
+            bf2c_asm_call(
+                assembler, offsetof(bf2c_jit_context_t, put), argument, sizeof(argument));
+            break;
+        }
+        case COMMAND_TYPE_IN: {
+            uint8_t const argument[] = {0x48, 0x89, 0xDE}; // mov rsi, rbx
+            bf2c_asm_call(
+                assembler, offsetof(bf2c_jit_context_t, get), argument, sizeof(argument));
+            break;
+        }
+        case COMMAND_TYPE_DEBUG: {
+            uint8_t const argument[] = {0x48, 0x89, 0xDE}; // mov rsi, rbx
+            bf2c_asm_call(
+                assembler, offsetof(bf2c_jit_context_t, debug), argument, sizeof(argument));
+            break;
+        }
+        case COMMAND_TYPE_UNKNOWN: break;
+    }
+}
+
+static void bf2c_asm_prologue(bf2c_asm_t* assembler) {
+    ASM(assembler, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57); // push rbx, r12 - r15
+    ASM(assembler, 0x49, 0x89, 0xFF);                                     // mov r15, rdi
+    ASM(assembler, 0x49, 0x8B, 0x5F, (uint8_t) offsetof(bf2c_jit_context_t, cell));  // rbx
+    ASM(assembler, 0x4D, 0x8B, 0x67, (uint8_t) offsetof(bf2c_jit_context_t, begin)); // r12
+    ASM(assembler, 0x4D, 0x8B, 0x6F, (uint8_t) offsetof(bf2c_jit_context_t, end));   // r13
+    ASM(assembler, 0x4D, 0x8B, 0x77, (uint8_t) offsetof(bf2c_jit_context_t, io));    // r14
+}
+
+// Return the status in eax, the exits with other statuses jump here. Every exit out of the tape
+// first stores its command in the context.
+static void bf2c_asm_epilogue(bf2c_asm_t* assembler) {
+    ASM(assembler, 0x31, 0xC0); // xor eax, eax
+    size_t const exit = assembler->code.size;
+    ASM(assembler, 0x49, 0x89, 0x5F, (uint8_t) offsetof(bf2c_jit_context_t, cell)); // store rbx
+    ASM(assembler, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);     // pop, ret
+
+    VEC_FOR_EACH (size_t, position, assembler->io_error) {
+        bf2c_asm_patch(assembler, position, assembler->code.size);
+    }
+    ASM(assembler, 0xB8, BF2C_JIT_IO_ERROR, 0, 0, 0, 0xE9); // mov eax, status; jmp exit
+    bf2c_asm_patch(assembler, bf2c_asm_rel32(assembler), exit);
+
+    size_t const out_of_tape = assembler->code.size;
+    ASM(assembler, 0xB8, BF2C_JIT_OUT_OF_TAPE, 0, 0, 0, 0xE9); // mov eax, status; jmp exit
+    bf2c_asm_patch(assembler, bf2c_asm_rel32(assembler), exit);
+    for (size_t i = 0; i < assembler->out_of_tape.size; ++i) {
+        bf2c_asm_patch(assembler, assembler->out_of_tape.data[i], assembler->code.size);
+        // mov qword [r15 + command], imm32
+        ASM(assembler, 0x49, 0xC7, 0x47, (uint8_t) offsetof(bf2c_jit_context_t, command));
+        bf2c_asm_u32(assembler, (uint32_t) assembler->out_of_tape_commands.data[i]);
+        ASM(assembler, 0xE9); // jmp
+        bf2c_asm_patch(assembler, bf2c_asm_rel32(assembler), out_of_tape);
+    }
+}
+
+bool bf2c_jit_compile(program_t const* program,
+                      size_t begin,
+                      size_t end,
+                      bf2c_options_t const* options,
+                      bf2c_jit_code_t* code) {
+    ABORT_IF(!program || !options || !code || begin > end || end > program->commands.size);
+    bf2c_asm_t assembler = {
+        .code                 = core_vec_char_with_capacity(16 * (end - begin) + 64),
+        .out_of_tape          = core_vec_size_create(),
+        .out_of_tape_commands = core_vec_size_create(),
+        .io_error             = core_vec_size_create(),
+        .failed               = end > INT32_MAX, // the commands are stored as imm32
+    };
+    size_t* loop_positions = malloc((end - begin + 1) * sizeof(size_t));
+    LOG_MSG_AND_ABORT_IF(!loop_positions, "Failed to allocate loop positions.");
+    bf2c_asm_prologue(&assembler);
+    for (size_t i = begin; i < end && !assembler.failed; ++i) {
+        command_t const command = command_vec_at(&program->commands, i);
+        bool const is_loop =
+            command.type == COMMAND_TYPE_LOOP_START || command.type == COMMAND_TYPE_LOOP_END;
+        int64_t const delta = is_loop ? bf2c_program_loop_delta(program, i) : 0;
+        assembler.command   = i;
+        bf2c_asm_command(&assembler, command, delta, loop_positions, i - begin, options->cell_bits);
+    }
+    bf2c_asm_epilogue(&assembler);
+    free(loop_positions);
+
+    bool success = !assembler.failed && assembler.code.size <= INT32_MAX;
+    *code        = (bf2c_jit_code_t){0};
+    if (success) {
+        // written while it is only writable, then only executable
+        void* memory = mmap(NULL,
+                            assembler.code.size,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS,
+                            -1,
+                            0);
+        success      = memory != MAP_FAILED;
+        if (success) {
+            memcpy(memory, assembler.code.data, assembler.code.size);
+            success = mprotect(memory, assembler.code.size, PROT_READ | PROT_EXEC) == 0;
+            *code   = (bf2c_jit_code_t){memory, assembler.code.size};
+        }
+    }
+    LOG_DEBUG("Compiled %zu commands to %zu bytes", end - begin, assembler.code.size);
+    core_vec_char_destroy(&assembler.code);
+    core_vec_size_destroy(&assembler.out_of_tape);
+    core_vec_size_destroy(&assembler.out_of_tape_commands);
+    core_vec_size_destroy(&assembler.io_error);
+    if (!success) {
+        bf2c_jit_destroy(code);
+    }
+    return success;
+}
+
+bf2c_jit_status_t bf2c_jit_run(bf2c_jit_code_t const* code, bf2c_jit_context_t* context) {
+    ABORT_IF(!code || !code->memory || !context);
+    // object pointers cannot be converted to function pointers in ISO C
+    int (*func)(bf2c_jit_context_t*) = NULL;
+    memcpy(&func, &code->memory, sizeof(func));
+    return (bf2c_jit_status_t) func(context);
+}
+
+void bf2c_jit_destroy(bf2c_jit_code_t* code) {
+    if (code && code->memory) {
+        (void) munmap(code->memory, code->size);
+        *code = (bf2c_jit_code_t){0};
+    }
+}
+
+#else
+
+bool bf2c_jit_compile(program_t const* program,
+                      size_t begin,
+                      size_t end,
+                      bf2c_options_t const* options,
+                      bf2c_jit_code_t* code) {
+    ABORT_IF(!program || !options || !code || begin > end || end > program->commands.size);
+    *code = (bf2c_jit_code_t){0};
+    return false;
+}
+
+bf2c_jit_status_t bf2c_jit_run(bf2c_jit_code_t const* code, bf2c_jit_context_t* context) {
+    ABORT_IF(!code || !context);
+    LOG_MSG_AND_ABORT("There is no code to run without the JIT.");
+    return BF2C_JIT_DONE;
+}
+
+void bf2c_jit_destroy(bf2c_jit_code_t* code) {
+    (void) code;
+}
+
+#endif /* ifdef BF2C_JIT_X86_64 */
@@ -0,0 +1,43 @@
+#include "bf2c/options.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bf2c/program.h"
+#include "core/abort.h"
+
+enum { DEFAULT_CELL_BITS = 8 };
+
+bf2c_options_t bf2c_options_default(void) {
+    return (bf2c_options_t){.eval_steps = BF2C_EVAL_STEPS,
+                            .tape_size  = BF2C_TAPE_SIZE,
+                            .cell_bits  = DEFAULT_CELL_BITS,
+                            .engine     = BF2C_ENGINE_TIERED};
+}
+
+bool bf2c_options_are_valid(bf2c_options_t const* options) {
+    ABORT_IF(!options);
+    // idx is an unsigned int in the emitted program
+    return options->tape_size > 0 && options->tape_size <= INT32_MAX &&
+           (options->cell_bits == 8 || options->cell_bits == 16 || options->cell_bits == 32);
+}
+
+uint32_t bf2c_options_cell_mask(bf2c_options_t const* options) {
+    ABORT_IF(!options);
+    return options->cell_bits >= 32 ? UINT32_MAX : (1U << options->cell_bits) - 1U;
+}
+
+bool bf2c_engine_from_string(char const* name, bf2c_engine_t* engine) {
+    ABORT_IF(!name || !engine);
+    if (strcmp(name, "interpreter") == 0) {
+        *engine = BF2C_ENGINE_INTERPRETER;
+    } else if (strcmp(name, "jit") == 0) {
+        *engine = BF2C_ENGINE_JIT;
+    } else if (strcmp(name, "tiered") == 0) {
+        *engine = BF2C_ENGINE_TIERED;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -1,128 +1,234 @@
 #include "bf2c/parser.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "bf2c/command.h"
 #include "bf2c/program.h"
+#include "bf2c/source.h"
 #include "bf2c/token.h"
 #include "core/abort.h"
 #include "core/logging.h"
 #include "core/vector.h"
 
+#ifdef BF2C_HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 // declare constant as enum
 enum {
-    BUFFER_SIZE = 1024
+    // streamed input (pipes, stdin) is read in large blocks to keep the number of syscalls low
+    READ_BLOCK_SIZE = 1 << 20,
+    // input is classified in blocks of this size, so only one block of tokens exists at a time
+    FILTER_BLOCK_SIZE = 1 << 12,
+    // smallest chunk worth a thread when parsing a file in parallel
+    MIN_PARALLEL_CHUNK_SIZE = 1 << 20
 };
 
-VECTOR_DECLARE_AND_DEFINE_WITH_PREFIX(token_vec_t, token_vec, token_type_t, void, TRIVIAL_COMP)
+// Largest part of a run which fits into a single command.
+static int32_t bf2c_run_piece(int64_t value) {
+    return value > INT32_MAX ? INT32_MAX : value < -INT32_MAX ? -INT32_MAX : (int32_t) value;
+}
 
-static token_vec_t bf2c_parse_tokens_from_file(FILE* file) {
-    token_vec_t tokens = token_vec_create();
-    if (!file) {
-        // no input, return empty vector
-        return tokens;
+// Number of commands a run is split into.
+static size_t bf2c_run_length(int64_t value) {
+    uint64_t const magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+    return (size_t) ((magnitude + INT32_MAX - 1) / INT32_MAX);
+}
+
+static void bf2c_parser_flush_run(bf2c_parser_t* parser) {
+    if (parser->has_run) {
+        for (int64_t value = parser->run_value; value != 0;) {
+            int32_t const piece = bf2c_run_piece(value);
+            command_vec_push_back(&parser->commands, (command_t){piece, parser->run_type, 0});
+            value -= piece;
+        }
     }
+    parser->has_run = false;
+}
 
-    char buffer[BUFFER_SIZE];
-    while (!feof(file)) {
-        size_t const ret_val = fread(buffer, sizeof(buffer[0]), BUFFER_SIZE, file);
-        for (size_t i = 0; i < ret_val; ++i) {
-            token_type_t token = bf2c_token_from_char(buffer[i]);
-            if (token != TOKEN_COMMENT) {
-                token_vec_push_back(&tokens, token);
-            }
+static program_t bf2c_program_from_parts(command_vec_t commands, command_wide_vec_t wide_deltas) {
+    command_wide_vec_sort(&wide_deltas);
+    program_t program = bf2c_program_create(commands);
+    command_wide_vec_destroy(&program.wide_deltas);
+    program.wide_deltas = wide_deltas;
+    return program;
+}
+
+// Consume a single token.
+// A loop end without an open loop aborts, unless `dangling_ends` is given to collect them.
+// The latter is used when parsing a chunk whose loop may have been opened in an earlier chunk.
+static inline void bf2c_parser_push_token(bf2c_parser_t* parser,
+                                          token_type_t token,
+                                          core_vec_size_t* dangling_ends) {
+    command_type_t const cur = bf2c_command_from_token(token);
+    if (bf2c_command_is_additive(cur)) {
+        // Match streaks of "additive" commands
+        if (!parser->has_run || parser->run_type != cur) {
+            bf2c_parser_flush_run(parser);
+            parser->run_type  = cur;
+            parser->run_value = 0;
+            parser->has_run   = true;
         }
-        if (ferror(file)) {
-            LOG_ERROR_MSG("Error reading file");
-            // OR Abort
-            // OR clear vector and return
-            token_vec_destroy(&tokens);
-            return token_vec_create();
+        parser->run_value += bf2c_command_value(token);
+        return;
+    }
+
+    // Match non-"additive" commands
+    bf2c_parser_flush_run(parser);
+    size_t const idx = parser->commands.size;
+    if (cur == COMMAND_TYPE_LOOP_START) {
+        core_vec_size_push_back(&parser->open_loops, idx);
+        command_vec_push_back(&parser->commands, (command_t){0, cur, 0});
+    } else if (cur == COMMAND_TYPE_LOOP_END) {
+        if (core_vec_size_is_empty(&parser->open_loops)) {
+            // TODO: return a result/error instead of aborting
+            LOG_AND_ABORT_IF(!dangling_ends,
+                             "Unmatched loop end at index %zu",
+                             parser->taken + idx);
+            // matched when the chunks are stitched together
+            core_vec_size_push_back(dangling_ends, idx);
+            command_vec_push_back(&parser->commands, (command_t){0, cur, 0});
+            return;
         }
+        size_t const start = core_vec_size_pop_back(&parser->open_loops);
+        command_vec_push_back(&parser->commands, (command_t){0, cur, 0});
+        command_vec_link_loop(&parser->commands, &parser->wide_deltas, start, idx);
+    } else {
+        command_vec_push_back(&parser->commands, (command_t){0, cur, 0});
     }
-    return tokens;
 }
 
-static token_vec_t bf2c_parse_tokens_from_text(char const* text) {
-    token_vec_t tokens = token_vec_create();
-    if (!text) {
-        // no input, return empty vector
-        return tokens;
+bf2c_parser_t bf2c_parser_create(void) {
+    return (bf2c_parser_t){
+        .commands    = command_vec_create(),
+        .wide_deltas = command_wide_vec_create(),
+        .open_loops  = core_vec_size_create(),
+        .taken       = 0,
+        .run_type    = COMMAND_TYPE_UNKNOWN,
+        .run_value   = 0,
+        .has_run     = false,
+    };
+}
+
+void bf2c_parser_destroy(bf2c_parser_t* parser) {
+    if (parser) {
+        command_vec_destroy(&parser->commands);
+        command_wide_vec_destroy(&parser->wide_deltas);
+        core_vec_size_destroy(&parser->open_loops);
+        parser->taken   = 0;
+        parser->has_run = false;
     }
+}
 
-    char cur = 0;
-    while ((cur = *text++)) {
-        token_type_t token = bf2c_token_from_char(cur);
-        if (token != TOKEN_COMMENT) {
-            token_vec_push_back(&tokens, token);
+void bf2c_parser_feed(bf2c_parser_t* parser, char const* source, size_t size) {
+    ABORT_IF(!parser || (!source && size > 0));
+    token_type_t tokens[FILTER_BLOCK_SIZE];
+    for (size_t offset = 0; offset < size; offset += FILTER_BLOCK_SIZE) {
+        size_t const len   = size - offset < FILTER_BLOCK_SIZE ? size - offset : FILTER_BLOCK_SIZE;
+        size_t const count = bf2c_token_filter(source + offset, len, tokens);
+        for (size_t i = 0; i < count; ++i) {
+            bf2c_parser_push_token(parser, tokens[i], NULL);
         }
     }
-    return tokens;
-}
-
-// OR return pointer
-static program_t bf2c_parse_program(token_vec_t const* tokens) {
-    // OR this function takes ownership of the tokens and frees them
-    command_vec_t commands = command_vec_create();
-
-    size_t idx = 0;
-    while (idx < tokens->size) {
-        token_type_t tok   = tokens->data[idx];
-        command_type_t cur = bf2c_command_from_token(tok);
-        if (cur == COMMAND_TYPE_CHANGE_PTR || cur == COMMAND_TYPE_CHANGE_VAL) {
-            // Match streaks of "additive" commands
-            int32_t value = bf2c_command_value(tok);
-            while (idx < tokens->size - 1 && bf2c_command_from_token(tokens->data[idx + 1]) == cur)
-            {
-                ++idx;
-                value += bf2c_command_value(tokens->data[idx]);
-            }
-            if (value != 0) {
-                command_vec_push_back(&commands, (command_t){value, cur});
-            }
-        } else {
-            // Match non-"additive" commands
-            command_vec_push_back(&commands, (command_t){0, cur});
-        }
-        ++idx;
+}
+
+program_t bf2c_parser_take_completed(bf2c_parser_t* parser) {
+    ABORT_IF(!parser);
+    command_vec_t* commands = &parser->commands;
+    size_t const completed =
+        core_vec_size_is_empty(&parser->open_loops) ? commands->size : parser->open_loops.data[0];
+    if (completed == commands->size) {
+        // hand over the whole buffer, nothing is left to keep
+        command_vec_t const taken           = *commands;
+        command_wide_vec_t const taken_wide = parser->wide_deltas;
+        *commands                           = command_vec_create();
+        parser->wide_deltas                 = command_wide_vec_create();
+        parser->taken += taken.size;
+        return bf2c_program_from_parts(taken, taken_wide);
     }
 
-    // Match loops
-    core_vec_size_t stack = core_vec_size_create();
-    for (size_t i = 0; i < commands.size; ++i) {
-        command_type_t cur = commands.data[i].type;
-        if (cur == COMMAND_TYPE_LOOP_START) {
-            core_vec_size_push_back(&stack, i);
-        } else if (cur == COMMAND_TYPE_LOOP_END) {
-            // TODO: return a result/error instead of aborting
-            LOG_AND_ABORT_IF(core_vec_size_is_empty(&stack), "Unmatched loop end at index %zu", i);
-            size_t start               = core_vec_size_pop_back(&stack);
-            int32_t const delta        = (int32_t) (i - start); // FIXME: potential data loss
-            commands.data[start].value = delta;
-            commands.data[i].value     = -delta;
+    // Keep the open loops. Loop deltas are relative, only the stack needs rebasing.
+    command_vec_t const taken = command_vec_from_range(commands, 0, completed);
+    command_vec_erase_front(commands, completed);
+    VEC_FOR_EACH_REF (size_t, open, parser->open_loops) {
+        *open -= completed;
+    }
+    // the out of line deltas belong to either part, as no loop crosses the split
+    command_wide_vec_t taken_wide = command_wide_vec_create();
+    size_t kept                   = 0;
+    VEC_FOR_EACH (command_wide_value_t, wide, parser->wide_deltas) {
+        if (wide.index < completed) {
+            command_wide_vec_push_back(&taken_wide, wide);
+        } else {
+            parser->wide_deltas.data[kept++] = (command_wide_value_t){wide.index - completed,
+                                                                      wide.value};
         }
     }
+    parser->wide_deltas.size = kept;
+    parser->taken += completed;
+    return bf2c_program_from_parts(taken, taken_wide);
+}
+
+program_t bf2c_parser_finish(bf2c_parser_t* parser) {
+    ABORT_IF(!parser);
+    bf2c_parser_flush_run(parser);
     // TODO: return a result/error instead of aborting
     // TODO: can we match this back to the original source or at least token?
-    LOG_AND_ABORT_IF(!core_vec_size_is_empty(&stack),
+    LOG_AND_ABORT_IF(!core_vec_size_is_empty(&parser->open_loops),
                      "Unmatched loop start at index %zu",
-                     stack.data[0]);
-    core_vec_size_destroy(&stack);
-    return bf2c_program_create(commands);
+                     parser->taken + parser->open_loops.data[0]);
+    command_vec_t commands         = parser->commands;
+    command_wide_vec_t wide_deltas = parser->wide_deltas;
+    command_vec_shrink_to_fit(&commands);
+    parser->commands    = command_vec_create();
+    parser->wide_deltas = command_wide_vec_create();
+    bf2c_parser_destroy(parser);
+    return bf2c_program_from_parts(commands, wide_deltas);
 }
 
 // OR return a result
 program_t bf2c_parse_file(FILE* file) {
-    token_vec_t tokens = bf2c_parse_tokens_from_file(file);
-    program_t program  = bf2c_parse_program(&tokens);
-    token_vec_destroy(&tokens);
-    return program;
+    bf2c_parser_t parser = bf2c_parser_create();
+    if (!file) {
+        // no input, return empty program
+        return bf2c_parser_finish(&parser);
+    }
+
+    char* buffer = malloc(READ_BLOCK_SIZE);
+    LOG_MSG_AND_ABORT_IF(!buffer, "Failed to allocate read buffer.");
+    bool error     = false;
+    size_t ret_val = 0;
+    while ((ret_val = bf2c_source_read_block(file, buffer, READ_BLOCK_SIZE, &error)) > 0) {
+        bf2c_parser_feed(&parser, buffer, ret_val);
+    }
+    free(buffer);
+    if (error) {
+        LOG_ERROR_MSG("Error reading file");
+        // OR Abort
+        // OR clear program and return
+        bf2c_parser_destroy(&parser);
+        return bf2c_program_create(command_vec_create());
+    }
+    return bf2c_parser_finish(&parser);
 }
 
 // TODO: add result for program_t with parser errors as error type
 // OR return a result
 program_t bf2c_parse_file_by_name(char const* filename) {
+    bf2c_source_t source;
+    if (bf2c_source_map_file(&source, filename)) {
+        // regular file: scan the mapping in place instead of copying it through a buffer
+        LOG_DEBUG("Parsing mapped file: %s (%zu bytes)", filename, source.size);
+        program_t const program = bf2c_parse_buffer(source.data, source.size);
+        bf2c_source_unmap(&source);
+        return program;
+    }
+
+    // not mappable (e.g. a pipe or character device), stream it instead
     FILE* file = fopen(filename, "r");
     if (!file) {
         // TODO: return a result with error
@@ -137,8 +243,234 @@ program_t bf2c_parse_file_by_name(char const* filename) {
 // TODO: add result for program_t with parser errors as error type
 // OR return a result
 program_t bf2c_parse_text(char const* text) {
-    token_vec_t tokens = bf2c_parse_tokens_from_text(text);
-    program_t program  = bf2c_parse_program(&tokens);
-    token_vec_destroy(&tokens);
+    return text ? bf2c_parse_buffer(text, strlen(text)) : bf2c_parse_buffer(NULL, 0);
+}
+
+program_t bf2c_parse_buffer(char const* source, size_t size) {
+    bf2c_parser_t parser = bf2c_parser_create();
+    bf2c_parser_feed(&parser, source, size);
+    return bf2c_parser_finish(&parser);
+}
+
+// Parallel parsing
+//
+// The source is split into chunks which are parsed independently. Each chunk keeps
+// - the run at its start separately, as it may continue the run at the end of the previous chunk,
+// - the run at its end pending, as it may continue in the next chunk,
+// - its loop ends without a loop start in the chunk, as well as its unclosed loop starts.
+// Loops within a chunk are already matched, their deltas stay valid after concatenation.
+typedef struct bf2c_run_t {
+    int64_t value;
+    command_type_t type;
+} bf2c_run_t;
+
+typedef struct bf2c_parse_chunk_t {
+    char const* source;
+    size_t size;
+    bf2c_parser_t parser;          // the body, i.e. everything after the leading run
+    core_vec_size_t dangling_ends; // indices of loop ends in the body opened in earlier chunks
+    bf2c_run_t lead;               // the leading run, if has_lead is set
+    bool has_lead;
+    bool lead_closed;              // whether any other token follows the leading run
+    bf2c_run_t flushed[2];         // runs completed during stitching which precede the body
+    size_t num_flushed;
+    size_t offset;                 // position of the body in the resulting commands
+    command_vec_t* target;         // the resulting commands
+} bf2c_parse_chunk_t;
+
+static void* bf2c_parse_chunk(void* arg) {
+    bf2c_parse_chunk_t* chunk = (bf2c_parse_chunk_t*) arg;
+    token_type_t tokens[FILTER_BLOCK_SIZE];
+    for (size_t offset = 0; offset < chunk->size; offset += FILTER_BLOCK_SIZE) {
+        size_t const len   = chunk->size - offset < FILTER_BLOCK_SIZE ? chunk->size - offset
+                                                                      : FILTER_BLOCK_SIZE;
+        size_t const count = bf2c_token_filter(chunk->source + offset, len, tokens);
+        size_t i           = 0;
+        for (; i < count && !chunk->lead_closed; ++i) {
+            command_type_t const cur = bf2c_command_from_token(tokens[i]);
+            if (!bf2c_command_is_additive(cur) || (chunk->has_lead && chunk->lead.type != cur)) {
+                chunk->lead_closed = true;
+                break;
+            }
+            chunk->lead.type = cur;
+            chunk->lead.value += bf2c_command_value(tokens[i]);
+            chunk->has_lead = true;
+        }
+        for (; i < count; ++i) {
+            bf2c_parser_push_token(&chunk->parser, tokens[i], &chunk->dangling_ends);
+        }
+    }
+    return NULL;
+}
+
+static void* bf2c_copy_chunk(void* arg) {
+    bf2c_parse_chunk_t const* chunk = (bf2c_parse_chunk_t const*) arg;
+    command_vec_t const* body       = &chunk->parser.commands;
+    if (body->size > 0) {
+        memcpy(chunk->target->types + chunk->offset, body->types, body->size * sizeof(uint8_t));
+        memcpy(chunk->target->values + chunk->offset, body->values, body->size * sizeof(int32_t));
+    }
+    return NULL;
+}
+
+// Run `task` for every chunk, on one thread per chunk where available.
+static void bf2c_run_on_chunks(void* (*task)(void*), bf2c_parse_chunk_t* chunks, size_t count) {
+#ifdef BF2C_HAVE_PTHREADS
+    pthread_t* threads = malloc(count * sizeof(pthread_t));
+    LOG_MSG_AND_ABORT_IF(!threads, "Failed to allocate threads.");
+    // the calling thread takes the first chunk and any chunk no thread could be started for
+    size_t started = 1;
+    while (started < count && pthread_create(&threads[started], NULL, task, &chunks[started]) == 0)
+    {
+        ++started;
+    }
+    (void) task(&chunks[0]);
+    for (size_t i = started; i < count; ++i) {
+        (void) task(&chunks[i]);
+    }
+    for (size_t i = 1; i < started; ++i) {
+        (void) pthread_join(threads[i], NULL);
+    }
+    free(threads);
+#else
+    for (size_t i = 0; i < count; ++i) {
+        (void) task(&chunks[i]);
+    }
+#endif
+}
+
+static void bf2c_stitch_flush(bf2c_run_t* pending, bool* has_pending, bf2c_parse_chunk_t* chunk) {
+    if (*has_pending && pending->value != 0) {
+        chunk->flushed[chunk->num_flushed++] = *pending;
+    }
+    *has_pending = false;
+}
+
+// Write a stitched run at `index`, split like bf2c_parser_flush_run does.
+// Returns the index behind the run.
+static size_t bf2c_stitch_write(command_vec_t* target, size_t index, bf2c_run_t run) {
+    for (int64_t value = run.value; value != 0;) {
+        int32_t const piece = bf2c_run_piece(value);
+        command_vec_set(target, index++, (command_t){piece, run.type, 0});
+        value -= piece;
+    }
+    return index;
+}
+
+program_t bf2c_parse_buffer_parallel(char const* source, size_t size, size_t num_threads) {
+    ABORT_IF(!source && size > 0);
+    size_t const count = num_threads == 0 ? 1 : num_threads < size ? num_threads : size;
+    if (count <= 1) {
+        return bf2c_parse_buffer(source, size);
+    }
+
+    bf2c_parse_chunk_t* chunks = calloc(count, sizeof(bf2c_parse_chunk_t));
+    LOG_MSG_AND_ABORT_IF(!chunks, "Failed to allocate parser chunks.");
+    for (size_t i = 0; i < count; ++i) {
+        size_t const begin      = size / count * i;
+        size_t const end        = i + 1 == count ? size : size / count * (i + 1);
+        chunks[i].source        = source + begin;
+        chunks[i].size          = end - begin;
+        chunks[i].parser        = bf2c_parser_create();
+        chunks[i].lead.type     = COMMAND_TYPE_UNKNOWN;
+        chunks[i].dangling_ends = core_vec_size_create();
+    }
+    bf2c_run_on_chunks(bf2c_parse_chunk, chunks, count);
+
+    // Stitch the runs at the chunk boundaries and lay out the bodies.
+    bf2c_run_t pending = {0, COMMAND_TYPE_UNKNOWN};
+    bool has_pending   = false;
+    size_t total       = 0;
+    for (size_t i = 0; i < count; ++i) {
+        bf2c_parse_chunk_t* chunk = &chunks[i];
+        if (chunk->has_lead) {
+            if (has_pending && pending.type == chunk->lead.type) {
+                pending.value += chunk->lead.value;
+            } else {
+                bf2c_stitch_flush(&pending, &has_pending, chunk);
+                pending     = chunk->lead;
+                has_pending = true;
+            }
+        }
+        if (chunk->lead_closed) {
+            bf2c_stitch_flush(&pending, &has_pending, chunk);
+        }
+        for (size_t j = 0; j < chunk->num_flushed; ++j) {
+            total += bf2c_run_length(chunk->flushed[j].value);
+        }
+        chunk->offset = total;
+        if (chunk->lead_closed) {
+            total += chunk->parser.commands.size;
+            if (chunk->parser.has_run) {
+                pending     = (bf2c_run_t){chunk->parser.run_value, chunk->parser.run_type};
+                has_pending = true;
+            }
+        }
+    }
+    size_t const tail = has_pending ? bf2c_run_length(pending.value) : 0;
+
+    command_vec_t commands = command_vec_with_capacity(total + tail);
+    commands.size          = total + tail;
+    size_t written         = 0;
+    for (size_t i = 0; i < count; ++i) {
+        chunks[i].target = &commands;
+        for (size_t j = 0; j < chunks[i].num_flushed; ++j) {
+            written = bf2c_stitch_write(&commands, written, chunks[i].flushed[j]);
+        }
+        written = chunks[i].offset + (chunks[i].lead_closed ? chunks[i].parser.commands.size : 0);
+    }
+    if (tail > 0) {
+        (void) bf2c_stitch_write(&commands, total, pending);
+    }
+    bf2c_run_on_chunks(bf2c_copy_chunk, chunks, count);
+
+    // Match the loops across chunks. The open loops before a chunk form its prefix depth, its
+    // dangling ends close the innermost of them (in order) and its open loops are added on top.
+    core_vec_size_t open_loops     = core_vec_size_create();
+    command_wide_vec_t wide_deltas = command_wide_vec_create();
+    for (size_t i = 0; i < count; ++i) {
+        bf2c_parse_chunk_t* chunk = &chunks[i];
+        VEC_FOR_EACH (command_wide_value_t, wide, chunk->parser.wide_deltas) {
+            command_wide_vec_push_back(
+                &wide_deltas, (command_wide_value_t){chunk->offset + wide.index, wide.value});
+        }
+        VEC_FOR_EACH (size_t, end, chunk->dangling_ends) {
+            size_t const idx = chunk->offset + end;
+            // TODO: return a result/error instead of aborting
+            LOG_AND_ABORT_IF(core_vec_size_is_empty(&open_loops),
+                             "Unmatched loop end at index %zu",
+                             idx);
+            size_t const start = core_vec_size_pop_back(&open_loops);
+            command_vec_link_loop(&commands, &wide_deltas, start, idx);
+        }
+        VEC_FOR_EACH (size_t, start, chunk->parser.open_loops) {
+            core_vec_size_push_back(&open_loops, chunk->offset + start);
+        }
+        bf2c_parser_destroy(&chunk->parser);
+        core_vec_size_destroy(&chunk->dangling_ends);
+    }
+    // TODO: return a result/error instead of aborting
+    LOG_AND_ABORT_IF(!core_vec_size_is_empty(&open_loops),
+                     "Unmatched loop start at index %zu",
+                     open_loops.data[0]);
+    core_vec_size_destroy(&open_loops);
+    free(chunks);
+    return bf2c_program_from_parts(commands, wide_deltas);
+}
+
+program_t bf2c_parse_file_by_name_parallel(char const* filename, size_t num_threads) {
+    bf2c_source_t source;
+    if (!bf2c_source_map_file(&source, filename)) {
+        // not mappable, there is no random access to split it
+        return bf2c_parse_file_by_name(filename);
+    }
+    size_t const max_threads = source.size / MIN_PARALLEL_CHUNK_SIZE;
+    size_t const threads     = num_threads < max_threads ? num_threads : max_threads;
+    LOG_DEBUG("Parsing mapped file: %s (%zu bytes) with %zu threads",
+              filename,
+              source.size,
+              threads > 0 ? threads : 1);
+    program_t const program = bf2c_parse_buffer_parallel(source.data, source.size, threads);
+    bf2c_source_unmap(&source);
     return program;
 }
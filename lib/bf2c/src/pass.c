@@ -0,0 +1,169 @@
+#include "bf2c/pass.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bf2c/command.h"
+#include "bf2c/program.h"
+#include "core/abort.h"
+#include "core/vector.h"
+
+#define PASS_CMP(a, b)       strcmp((a).name, (b).name)
+#define PASS_STATS_CMP(a, b) strcmp((a).name, (b).name)
+VECTOR_DEFINE_WITH_PREFIX(bf2c_pass_vec_t, bf2c_pass_vec, bf2c_pass_t, void, PASS_CMP)
+VECTOR_DEFINE_WITH_PREFIX(bf2c_pass_stats_vec_t,
+                          bf2c_pass_stats_vec,
+                          bf2c_pass_stats_t,
+                          void,
+                          PASS_STATS_CMP)
+
+bf2c_pass_manager_t bf2c_pass_manager_create(bf2c_options_t options) {
+    return (bf2c_pass_manager_t){options, bf2c_pass_vec_create(), bf2c_pass_stats_vec_create()};
+}
+
+void bf2c_pass_manager_destroy(bf2c_pass_manager_t* manager) {
+    if (manager) {
+        bf2c_pass_vec_destroy(&manager->passes);
+        bf2c_pass_stats_vec_destroy(&manager->stats);
+    }
+}
+
+void bf2c_pass_manager_add(bf2c_pass_manager_t* manager, bf2c_pass_t pass) {
+    ABORT_IF(!manager || !pass.name || !pass.run);
+    bf2c_pass_vec_push_back(&manager->passes, pass);
+}
+
+void bf2c_pass_manager_add_level(bf2c_pass_manager_t* manager, int level) {
+    // Clear loops (including the counters of multiplication loops) and scan loops before the dead
+    // loops, they make the cell known to be zero. Removing dead loops may leave runs to combine.
+    if (level >= 2) {
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"mul-loops", bf2c_pass_mul_loops});
+    }
+    if (level >= 1) {
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"clear-loops", bf2c_pass_clear_loops});
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"scan-loops", bf2c_pass_scan_loops});
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"dead-loops", bf2c_pass_dead_loops});
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"combine-runs", bf2c_pass_combine_runs});
+    }
+    if (level >= 2) {
+        // late, the other passes expect the cells of the loops at offset zero
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"offsets", bf2c_pass_offsets});
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"known-output", bf2c_pass_known_output});
+    }
+    if (level >= 3) {
+        // last, to run the program in its final form
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"partial-eval", bf2c_pass_partial_eval});
+    }
+}
+
+void bf2c_pass_manager_add_fragment_level(bf2c_pass_manager_t* manager, int level) {
+    if (level >= 2) {
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"mul-loops", bf2c_pass_mul_loops});
+    }
+    if (level >= 1) {
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"clear-loops", bf2c_pass_clear_loops});
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"scan-loops", bf2c_pass_scan_loops});
+    }
+    if (level >= 2) {
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"offsets", bf2c_pass_offsets});
+        bf2c_pass_manager_add(manager, (bf2c_pass_t){"known-output", bf2c_pass_known_output});
+    }
+}
+
+void bf2c_pass_manager_add_defaults(bf2c_pass_manager_t* manager) {
+    bf2c_pass_manager_add_level(manager, BF2C_OPT_LEVEL_DEFAULT);
+}
+
+void bf2c_pass_manager_add_fragment_defaults(bf2c_pass_manager_t* manager) {
+    bf2c_pass_manager_add_fragment_level(manager, BF2C_OPT_LEVEL_DEFAULT);
+}
+
+void bf2c_pass_manager_run(bf2c_pass_manager_t* manager, program_t* program) {
+    ABORT_IF(!manager || !program);
+    if (manager->stats.size != manager->passes.size) {
+        // first run (or passes were added since)
+        bf2c_pass_stats_vec_clear(&manager->stats);
+        VEC_FOR_EACH (bf2c_pass_t, pass, manager->passes) {
+            bf2c_pass_stats_vec_push_back(&manager->stats, (bf2c_pass_stats_t){.name = pass.name});
+        }
+    }
+    size_t loops = command_vec_count(&program->commands, COMMAND_TYPE_LOOP_START);
+    VEC_FOR_EACH (bf2c_pass_t, pass, manager->passes) {
+        size_t const before = program->commands.size;
+        clock_t const start = clock();
+        pass.run(program, &manager->options);
+        clock_t const end         = clock();
+        bf2c_pass_stats_t* stats  = &manager->stats.data[pass_iterator];
+        size_t const loops_after  = command_vec_count(&program->commands, COMMAND_TYPE_LOOP_START);
+        stats->commands_before   += before;
+        stats->commands_after    += program->commands.size;
+        stats->loops_before      += loops;
+        stats->loops_after       += loops_after;
+        stats->seconds           += (double) (end - start) / CLOCKS_PER_SEC;
+        loops                     = loops_after;
+    }
+}
+
+size_t bf2c_pass_manager_describe(bf2c_pass_manager_t const* manager, char* buffer, size_t size) {
+    ABORT_IF(!manager || (!buffer && size > 0));
+    size_t length = 0;
+    VEC_FOR_EACH (bf2c_pass_t, pass, manager->passes) {
+        int const ret = snprintf(length < size ? buffer + length : NULL,
+                                 length < size ? size - length : 0,
+                                 "%s%s",
+                                 pass_iterator > 0 ? "," : "",
+                                 pass.name);
+        ABORT_IF(ret < 0);
+        length += (size_t) ret;
+    }
+    int const ret = snprintf(length < size ? buffer + length : NULL,
+                             length < size ? size - length : 0,
+                             ";eval-steps=%" PRIu64 ";tape-size=%zu;cell-bits=%u",
+                             manager->options.eval_steps,
+                             manager->options.tape_size,
+                             manager->options.cell_bits);
+    ABORT_IF(ret < 0);
+    return length + (size_t) ret;
+}
+
+void bf2c_pass_manager_print_stats(bf2c_pass_manager_t const* manager, FILE* file) {
+    ABORT_IF(!manager || !file);
+    (void) fprintf(file,
+                   "%-14s %12s %12s %10s %10s %10s\n",
+                   "pass",
+                   "commands",
+                   "-> commands",
+                   "loops",
+                   "removed",
+                   "ms");
+    bf2c_pass_stats_t total = {.name = "total"};
+    VEC_FOR_EACH (bf2c_pass_stats_t, stats, manager->stats) {
+        (void) fprintf(file,
+                       "%-14s %12zu %12zu %10zu %10zu %10.3f\n",
+                       stats.name,
+                       stats.commands_before,
+                       stats.commands_after,
+                       stats.loops_before,
+                       stats.loops_before - stats.loops_after,
+                       stats.seconds * 1000.0);
+        if (stats_iterator == 0) {
+            total.commands_before = stats.commands_before;
+            total.loops_before    = stats.loops_before;
+        }
+        total.commands_after = stats.commands_after;
+        total.loops_after    = stats.loops_after;
+        total.seconds       += stats.seconds;
+    }
+    (void) fprintf(file,
+                   "%-14s %12zu %12zu %10zu %10zu %10.3f\n",
+                   total.name,
+                   total.commands_before,
+                   total.commands_after,
+                   total.loops_before,
+                   total.loops_before - total.loops_after,
+                   total.seconds * 1000.0);
+}
@@ -0,0 +1,634 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bf2c/command.h"
+#include "bf2c/options.h"
+#include "bf2c/pass.h"
+#include "bf2c/program.h"
+#include "core/abort.h"
+#include "core/logging.h"
+#include "core/vector.h"
+
+// The cells wrap around, so the passes calculate modulo 2^options->cell_bits.
+enum {
+    // loops changing more cells are kept
+    MAX_MUL_TERMS = 16,
+    // cells with known values tracked by bf2c_pass_known_output
+    MAX_KNOWN_CELLS = 16,
+    // cells of the tape used by the partial evaluation at most, it stops at the end of them
+    MAX_EVAL_TAPE_SIZE = 1 << 20
+};
+
+// Change of a cell (relative to the loop counter) per loop iteration
+typedef struct bf2c_mul_term_t {
+    int64_t offset;
+    int64_t change;
+} bf2c_mul_term_t;
+
+// The passes below compact the commands in place: the command at `i` is only read after the
+// commands before it were written to indices <= i. Loop deltas are recomputed afterwards.
+static void bf2c_pass_truncate(program_t* program, size_t size) {
+    if (size != program->commands.size) {
+        program->commands.size = size;
+        bf2c_program_link_loops(program);
+    }
+}
+
+void bf2c_pass_dead_loops(program_t* program, bf2c_options_t const* options) {
+    ABORT_IF(!program || !options);
+    (void) options;
+    command_vec_t* commands = &program->commands;
+    size_t size             = 0;
+    bool cell_is_zero       = true; // all cells are zero initially
+    for (size_t i = 0; i < commands->size; ++i) {
+        command_t const cmd = command_vec_at(commands, i);
+        bool const clears_cell =
+            cmd.type == COMMAND_TYPE_SCAN ||
+            (cmd.type == COMMAND_TYPE_SET && cmd.value == 0 && cmd.offset == 0);
+        bool const changes_cell = cmd.type == COMMAND_TYPE_CHANGE_PTR ||
+                                  cmd.type == COMMAND_TYPE_IN ||
+                                  cmd.type == COMMAND_TYPE_LOOP_START ||
+                                  ((cmd.type == COMMAND_TYPE_CHANGE_VAL ||
+                                    cmd.type == COMMAND_TYPE_SET) &&
+                                   cmd.offset == 0);
+        if (cell_is_zero && cmd.type == COMMAND_TYPE_LOOP_START) {
+            // skip the whole loop, the cell stays zero
+            i = bf2c_program_loop_match(program, i);
+            continue;
+        }
+        if (cell_is_zero && (clears_cell || cmd.type == COMMAND_TYPE_MUL)) {
+            // nothing to clear, nothing to multiply
+            continue;
+        }
+        command_vec_set(commands, size++, cmd);
+        cell_is_zero =
+            cmd.type == COMMAND_TYPE_LOOP_END || clears_cell || (cell_is_zero && !changes_cell);
+    }
+    bf2c_pass_truncate(program, size);
+}
+
+void bf2c_pass_combine_runs(program_t* program, bf2c_options_t const* options) {
+    ABORT_IF(!program || !options);
+    (void) options;
+    command_vec_t* commands = &program->commands;
+    size_t size             = 0;
+    for (size_t i = 0; i < commands->size; ++i) {
+        command_t const cmd = command_vec_at(commands, i);
+        if (bf2c_command_is_additive(cmd.type)) {
+            if (cmd.value == 0) {
+                continue;
+            }
+            if (size > 0 && commands->types[size - 1] == (uint8_t) cmd.type &&
+                command_vec_at(commands, size - 1).offset == cmd.offset)
+            {
+                // keep runs split, if they do not fit into a single command
+                int64_t const sum = (int64_t) commands->values[size - 1] + cmd.value;
+                if (sum >= -INT32_MAX && sum <= INT32_MAX) {
+                    if (sum == 0) {
+                        --size;
+                    } else {
+                        commands->values[size - 1] = (int32_t) sum;
+                    }
+                    continue;
+                }
+            }
+        }
+        command_vec_set(commands, size++, cmd);
+    }
+    bf2c_pass_truncate(program, size);
+}
+
+static bool bf2c_is_clear_loop(command_vec_t const* commands, size_t index) {
+    return index + 2 < commands->size && commands->types[index] == COMMAND_TYPE_LOOP_START &&
+           commands->types[index + 1] == COMMAND_TYPE_CHANGE_VAL &&
+           commands->values[index + 1] % 2 != 0 &&
+           command_vec_at(commands, index + 1).offset == 0 &&
+           commands->types[index + 2] == COMMAND_TYPE_LOOP_END;
+}
+
+// Add a CHANGE_VAL to the last written command, if that changes or sets the same cell.
+static bool bf2c_merge_change(command_vec_t* commands, size_t size, command_t cmd) {
+    if (size == 0 || cmd.type != COMMAND_TYPE_CHANGE_VAL) {
+        return false;
+    }
+    command_t const prev = command_vec_at(commands, size - 1);
+    if ((prev.type != COMMAND_TYPE_CHANGE_VAL && prev.type != COMMAND_TYPE_SET) ||
+        prev.offset != cmd.offset)
+    {
+        return false;
+    }
+    int64_t const sum = (int64_t) prev.value + cmd.value;
+    if (sum < -INT32_MAX || sum > INT32_MAX) {
+        return false;
+    }
+    commands->values[size - 1] = (int32_t) sum;
+    return true;
+}
+
+void bf2c_pass_clear_loops(program_t* program, bf2c_options_t const* options) {
+    ABORT_IF(!program || !options);
+    (void) options;
+    command_vec_t* commands = &program->commands;
+    size_t size             = 0;
+    for (size_t i = 0; i < commands->size; ++i) {
+        command_t cmd = command_vec_at(commands, i);
+        if (bf2c_is_clear_loop(commands, i)) {
+            cmd = (command_t){0, COMMAND_TYPE_SET, 0};
+            i += 2;
+        }
+        if (cmd.type == COMMAND_TYPE_SET && size > 0) {
+            command_t const prev = command_vec_at(commands, size - 1);
+            if ((prev.type == COMMAND_TYPE_CHANGE_VAL || prev.type == COMMAND_TYPE_SET) &&
+                prev.offset == cmd.offset)
+            {
+                // the previous value is overwritten
+                --size;
+            }
+        } else if (bf2c_merge_change(commands, size, cmd)) {
+            continue;
+        }
+        command_vec_set(commands, size++, cmd);
+    }
+    bf2c_pass_truncate(program, size);
+}
+
+// Multiplicative inverse of an odd value modulo 2^32, every Newton step doubles the correct bits.
+static uint32_t bf2c_inverse(uint32_t value) {
+    uint32_t inverse = value; // correct for the lowest 3 bits
+    for (int i = 0; i < 4; ++i) {
+        inverse *= 2U - value * inverse;
+    }
+    return inverse;
+}
+
+// Reduce a value modulo the cell width to the signed range, e.g. 255 is -1 for 8-bit cells.
+static int32_t bf2c_cell_value(uint32_t value, uint32_t mask) {
+    value &= mask;
+    return value > mask / 2 ? -(int32_t) (mask - value) - 1 : (int32_t) value;
+}
+
+// Collect the changes per iteration of a loop whose body only changes cells and moves the pointer,
+// with a net movement of zero and an odd change of the counter (the current cell), i.e. the loop
+// terminates after a number of iterations depending only on the counter.
+// Returns the number of terms with the counter first, or 0 if the loop does not qualify.
+static size_t bf2c_mul_loop_terms(command_vec_t const* commands,
+                                  size_t start,
+                                  size_t end,
+                                  bf2c_mul_term_t* terms) {
+    size_t count   = 1;
+    int64_t offset = 0;
+    terms[0]       = (bf2c_mul_term_t){0, 0};
+    for (size_t i = start + 1; i < end; ++i) {
+        command_t const cmd = command_vec_at(commands, i);
+        if (cmd.type == COMMAND_TYPE_CHANGE_PTR) {
+            offset += cmd.value;
+            continue;
+        }
+        int64_t const cell = offset + cmd.offset;
+        if (cmd.type != COMMAND_TYPE_CHANGE_VAL || cell < -INT32_MAX || cell > INT32_MAX) {
+            return 0;
+        }
+        size_t term = 0;
+        while (term < count && terms[term].offset != cell) {
+            ++term;
+        }
+        if (term == count) {
+            if (count == MAX_MUL_TERMS) {
+                return 0;
+            }
+            terms[count++] = (bf2c_mul_term_t){cell, 0};
+        }
+        terms[term].change += cmd.value;
+    }
+    return offset == 0 && terms[0].change % 2 != 0 ? count : 0;
+}
+
+void bf2c_pass_mul_loops(program_t* program, bf2c_options_t const* options) {
+    ABORT_IF(!program || !options);
+    uint32_t const mask     = bf2c_options_cell_mask(options);
+    command_vec_t* commands = &program->commands;
+    bf2c_mul_term_t terms[MAX_MUL_TERMS];
+    size_t size = 0;
+    for (size_t i = 0; i < commands->size; ++i) {
+        command_t const cmd = command_vec_at(commands, i);
+        if (cmd.type == COMMAND_TYPE_LOOP_START) {
+            size_t const end   = bf2c_program_loop_match(program, i);
+            size_t const count = bf2c_mul_loop_terms(commands, i, end, terms);
+            // loops without other cells are left to the clear-loops pass
+            if (count > 1) {
+                // The loop runs n times with counter + n * step = 0, i.e. n = counter * -step^-1.
+                // The commands fit into the loop, so they can be written before its end is read.
+                uint32_t const per_count = 0U - bf2c_inverse((uint32_t) terms[0].change);
+                for (size_t term = 1; term < count; ++term) {
+                    int32_t const factor =
+                        bf2c_cell_value((uint32_t) terms[term].change * per_count, mask);
+                    if (factor != 0) {
+                        command_vec_set(
+                            commands,
+                            size++,
+                            (command_t){factor, COMMAND_TYPE_MUL, (int32_t) terms[term].offset});
+                    }
+                }
+                command_vec_set(commands, size++, (command_t){0, COMMAND_TYPE_SET, 0});
+                i = end;
+                continue;
+            }
+        }
+        command_vec_set(commands, size++, cmd);
+    }
+    bf2c_pass_truncate(program, size);
+}
+
+void bf2c_pass_scan_loops(program_t* program, bf2c_options_t const* options) {
+    ABORT_IF(!program || !options);
+    (void) options;
+    command_vec_t* commands = &program->commands;
+    size_t size             = 0;
+    for (size_t i = 0; i < commands->size; ++i) {
+        command_t cmd = command_vec_at(commands, i);
+        if (cmd.type == COMMAND_TYPE_LOOP_START && i + 2 < commands->size &&
+            commands->types[i + 1] == COMMAND_TYPE_CHANGE_PTR &&
+            commands->types[i + 2] == COMMAND_TYPE_LOOP_END)
+        {
+            cmd = (command_t){commands->values[i + 1], COMMAND_TYPE_SCAN, 0};
+            i += 2;
+        }
+        command_vec_set(commands, size++, cmd);
+    }
+    bf2c_pass_truncate(program, size);
+}
+
+// Move the pointer by the deferred offset, if any.
+static size_t bf2c_flush_offset(command_vec_t* commands, size_t size, int64_t* offset) {
+    if (*offset != 0) {
+        command_vec_set(
+            commands, size++, (command_t){(int32_t) *offset, COMMAND_TYPE_CHANGE_PTR, 0});
+        *offset = 0;
+    }
+    return size;
+}
+
+void bf2c_pass_offsets(program_t* program, bf2c_options_t const* options) {
+    ABORT_IF(!program || !options);
+    (void) options;
+    command_vec_t* commands = &program->commands;
+    size_t size             = 0;
+    int64_t offset          = 0; // of the pointer, not yet applied to idx
+    for (size_t i = 0; i < commands->size; ++i) {
+        command_t cmd = command_vec_at(commands, i);
+        switch (cmd.type) {
+            case COMMAND_TYPE_CHANGE_PTR:
+                if (offset + cmd.value < -INT32_MAX || offset + cmd.value > INT32_MAX) {
+                    size = bf2c_flush_offset(commands, size, &offset);
+                }
+                offset += cmd.value;
+                continue;
+            case COMMAND_TYPE_CHANGE_VAL:
+            case COMMAND_TYPE_SET:
+                if (offset + cmd.offset < -INT32_MAX || offset + cmd.offset > INT32_MAX) {
+                    size = bf2c_flush_offset(commands, size, &offset);
+                }
+                cmd.offset = (int32_t) (offset + cmd.offset);
+                if (bf2c_merge_change(commands, size, cmd)) {
+                    continue;
+                }
+                break;
+            case COMMAND_TYPE_WRITE:
+            case COMMAND_TYPE_UNKNOWN: break;
+            // Loops need idx at their boundaries, the others use the current cell.
+            case COMMAND_TYPE_LOOP_START:
+            case COMMAND_TYPE_LOOP_END:
+            case COMMAND_TYPE_OUT:
+            case COMMAND_TYPE_IN:
+            case COMMAND_TYPE_DEBUG:
+            case COMMAND_TYPE_MUL:
+            case COMMAND_TYPE_SCAN:       size = bf2c_flush_offset(commands, size, &offset); break;
+        }
+        command_vec_set(commands, size++, cmd);
+    }
+    // moving the pointer in front of a loop may shift it without changing the size
+    commands->size = bf2c_flush_offset(commands, size, &offset);
+    bf2c_program_link_loops(program);
+}
+
+// Cells with a value known at transpile time, by their position relative to idx at the start of
+// the basic block. Only a few cells are tracked, the oldest one is forgotten first.
+typedef struct bf2c_known_cells_t {
+    int64_t positions[MAX_KNOWN_CELLS];
+    uint32_t values[MAX_KNOWN_CELLS];
+    size_t size;
+    int64_t index; // position of idx
+    uint32_t mask; // of the cell width
+} bf2c_known_cells_t;
+
+static uint32_t const* bf2c_known_find(bf2c_known_cells_t const* known, int64_t position) {
+    for (size_t i = 0; i < known->size; ++i) {
+        if (known->positions[i] == position) {
+            return &known->values[i];
+        }
+    }
+    return NULL;
+}
+
+static void bf2c_known_forget(bf2c_known_cells_t* known, int64_t position) {
+    for (size_t i = 0; i < known->size; ++i) {
+        if (known->positions[i] == position) {
+            memmove(&known->positions[i],
+                    &known->positions[i + 1],
+                    (known->size - i - 1) * sizeof(known->positions[0]));
+            memmove(&known->values[i],
+                    &known->values[i + 1],
+                    (known->size - i - 1) * sizeof(known->values[0]));
+            --known->size;
+            return;
+        }
+    }
+}
+
+static void bf2c_known_set(bf2c_known_cells_t* known, int64_t position, uint32_t value) {
+    bf2c_known_forget(known, position);
+    if (known->size == MAX_KNOWN_CELLS) {
+        bf2c_known_forget(known, known->positions[0]);
+    }
+    known->positions[known->size] = position;
+    known->values[known->size]    = value & known->mask;
+    ++known->size;
+}
+
+// Update the known cells by a command which does not end the basic block.
+static void bf2c_known_apply(bf2c_known_cells_t* known, command_t cmd) {
+    int64_t const cell    = known->index + cmd.offset;
+    uint32_t const* value = bf2c_known_find(known, cell);
+    uint32_t const* count = bf2c_known_find(known, known->index);
+    switch (cmd.type) {
+        case COMMAND_TYPE_CHANGE_VAL:
+            if (value) {
+                bf2c_known_set(known, cell, *value + (uint32_t) cmd.value);
+            }
+            break;
+        case COMMAND_TYPE_SET:        bf2c_known_set(known, cell, (uint32_t) cmd.value); break;
+        case COMMAND_TYPE_CHANGE_PTR: known->index += cmd.value; break;
+        case COMMAND_TYPE_MUL:
+            if (count && *count == 0) {
+                break;
+            }
+            if (count && value) {
+                bf2c_known_set(known, cell, *value + (uint32_t) cmd.value * *count);
+            } else {
+                bf2c_known_forget(known, cell);
+            }
+            break;
+        case COMMAND_TYPE_IN: bf2c_known_forget(known, known->index); break;
+        // the cell at idx is zero behind a loop or scan, nothing else is known
+        case COMMAND_TYPE_LOOP_END:
+        case COMMAND_TYPE_SCAN:
+            known->size = 0;
+            bf2c_known_set(known, known->index, 0);
+            break;
+        case COMMAND_TYPE_LOOP_START: known->size = 0; break;
+        case COMMAND_TYPE_OUT:
+        case COMMAND_TYPE_WRITE:
+        case COMMAND_TYPE_DEBUG:
+        case COMMAND_TYPE_UNKNOWN:    break;
+    }
+}
+
+// Write the deferred outputs.
+static size_t bf2c_flush_writes(command_vec_t* commands, size_t size, core_vec_int_t* writes) {
+    VEC_FOR_EACH (int32_t, value, *writes) {
+        command_vec_set(commands, size++, (command_t){value, COMMAND_TYPE_WRITE, 0});
+    }
+    core_vec_int_clear(writes);
+    return size;
+}
+
+void bf2c_pass_known_output(program_t* program, bf2c_options_t const* options) {
+    ABORT_IF(!program || !options);
+    command_vec_t* commands  = &program->commands;
+    size_t size              = 0;
+    bf2c_known_cells_t known = {.mask = bf2c_options_cell_mask(options)};
+    // Writes do not depend on the cells, so they are deferred up to the next command with another
+    // effect on the output (or control flow), where they form a single run.
+    core_vec_int_t writes = core_vec_int_create();
+    for (size_t i = 0; i < commands->size; ++i) {
+        command_t cmd         = command_vec_at(commands, i);
+        uint32_t const* value = bf2c_known_find(&known, known.index);
+        if (cmd.type == COMMAND_TYPE_OUT && value) {
+            cmd = (command_t){(int32_t) *value, COMMAND_TYPE_WRITE, 0};
+        }
+        if (cmd.type == COMMAND_TYPE_WRITE) {
+            core_vec_int_push_back(&writes, cmd.value);
+            continue;
+        }
+        if (cmd.type == COMMAND_TYPE_OUT || cmd.type == COMMAND_TYPE_IN ||
+            cmd.type == COMMAND_TYPE_DEBUG || cmd.type == COMMAND_TYPE_LOOP_START ||
+            cmd.type == COMMAND_TYPE_LOOP_END)
+        {
+            size = bf2c_flush_writes(commands, size, &writes);
+        }
+        bf2c_known_apply(&known, cmd);
+        command_vec_set(commands, size++, cmd);
+    }
+    size = bf2c_flush_writes(commands, size, &writes);
+    core_vec_int_destroy(&writes);
+    bf2c_pass_truncate(program, size);
+}
+
+// Interpreter of the partial evaluation.
+// Cell writes are logged (once per cell and top-level command), so the tape can be reset to the
+// state after the last completed top-level command.
+typedef struct bf2c_eval_t {
+    uint32_t* cells;
+    uint32_t* epochs; // in which a cell was logged last
+    uint32_t epoch;
+    core_vec_size_t undo_cells;
+    core_vec_int_t undo_values;
+    int64_t index;
+    size_t size;   // of the tape
+    uint32_t mask; // of the cell width
+} bf2c_eval_t;
+
+// Returns false if the cell is not on the tape.
+static bool bf2c_eval_cell(bf2c_eval_t const* eval, int32_t offset, size_t* cell) {
+    int64_t const index = eval->index + offset;
+    if (index < 0 || index >= (int64_t) eval->size) {
+        return false;
+    }
+    *cell = (size_t) index;
+    return true;
+}
+
+static void bf2c_eval_write(bf2c_eval_t* eval, size_t cell, uint32_t value) {
+    if (eval->epochs[cell] != eval->epoch) {
+        eval->epochs[cell] = eval->epoch;
+        core_vec_size_push_back(&eval->undo_cells, cell);
+        core_vec_int_push_back(&eval->undo_values, (int32_t) eval->cells[cell]);
+    }
+    eval->cells[cell] = value & eval->mask;
+}
+
+static void bf2c_eval_commit(bf2c_eval_t* eval) {
+    eval->undo_cells.size  = 0;
+    eval->undo_values.size = 0;
+    if (++eval->epoch == 0) {
+        memset(eval->epochs, 0, eval->size * sizeof(eval->epochs[0]));
+        eval->epoch = 1;
+    }
+}
+
+static void bf2c_eval_rollback(bf2c_eval_t* eval) {
+    for (size_t i = eval->undo_cells.size; i > 0; --i) {
+        eval->cells[eval->undo_cells.data[i - 1]] = (uint32_t) eval->undo_values.data[i - 1];
+    }
+    bf2c_eval_commit(eval);
+}
+
+// Run a single command, returns false if the evaluation has to stop in front of it.
+static bool bf2c_eval_step(bf2c_eval_t* eval,
+                           program_t const* program,
+                           core_vec_char_t* output,
+                           size_t* pc,
+                           size_t* depth) {
+    command_t const cmd = command_vec_at(&program->commands, *pc);
+    size_t cell         = 0;
+    size_t source       = 0;
+    switch (cmd.type) {
+        case COMMAND_TYPE_CHANGE_VAL:
+            if (!bf2c_eval_cell(eval, cmd.offset, &cell)) {
+                return false;
+            }
+            bf2c_eval_write(eval, cell, eval->cells[cell] + (uint32_t) cmd.value);
+            break;
+        case COMMAND_TYPE_SET:
+            if (!bf2c_eval_cell(eval, cmd.offset, &cell)) {
+                return false;
+            }
+            bf2c_eval_write(eval, cell, (uint32_t) cmd.value);
+            break;
+        case COMMAND_TYPE_MUL:
+            if (!bf2c_eval_cell(eval, cmd.offset, &cell) || !bf2c_eval_cell(eval, 0, &source)) {
+                return false;
+            }
+            bf2c_eval_write(
+                eval, cell, eval->cells[cell] + (uint32_t) cmd.value * eval->cells[source]);
+            break;
+        case COMMAND_TYPE_CHANGE_PTR:
+            if (eval->index + cmd.value < 0 || eval->index + cmd.value >= (int64_t) eval->size) {
+                return false;
+            }
+            eval->index += cmd.value;
+            break;
+        case COMMAND_TYPE_SCAN:
+            if (!bf2c_eval_cell(eval, 0, &cell)) {
+                return false;
+            }
+            while (eval->cells[cell] != 0) {
+                if (!bf2c_eval_cell(eval, cmd.value, &cell)) {
+                    return false;
+                }
+                eval->index = (int64_t) cell;
+            }
+            break;
+        case COMMAND_TYPE_OUT:
+            if (!bf2c_eval_cell(eval, 0, &cell)) {
+                return false;
+            }
+            core_vec_char_push_back(output, (char) eval->cells[cell]);
+            break;
+        case COMMAND_TYPE_WRITE: core_vec_char_push_back(output, (char) cmd.value); break;
+        case COMMAND_TYPE_LOOP_START:
+            if (!bf2c_eval_cell(eval, 0, &cell)) {
+                return false;
+            }
+            if (eval->cells[cell] == 0) {
+                *pc = bf2c_program_loop_match(program, *pc) + 1;
+                return true;
+            }
+            ++*depth;
+            break;
+        case COMMAND_TYPE_LOOP_END:
+            if (!bf2c_eval_cell(eval, 0, &cell)) {
+                return false;
+            }
+            if (eval->cells[cell] != 0) {
+                *pc = bf2c_program_loop_match(program, *pc) + 1;
+                return true;
+            }
+            --*depth;
+            break;
+        // the input is unknown, debug prints more than the output
+        case COMMAND_TYPE_IN:
+        case COMMAND_TYPE_DEBUG:   return false;
+        case COMMAND_TYPE_UNKNOWN: break;
+    }
+    ++*pc;
+    return true;
+}
+
+void bf2c_pass_partial_eval(program_t* program, bf2c_options_t const* options) {
+    ABORT_IF(!program || !options);
+    program_state_t* state = &program->state;
+    size_t const tape_size =
+        options->tape_size < MAX_EVAL_TAPE_SIZE ? options->tape_size : MAX_EVAL_TAPE_SIZE;
+    if (options->eval_steps == 0 || state->index >= tape_size || state->cells.size > tape_size) {
+        return;
+    }
+    bf2c_eval_t eval = {
+        .cells       = calloc(tape_size, sizeof(uint32_t)),
+        .epochs      = calloc(tape_size, sizeof(uint32_t)),
+        .epoch       = 1,
+        .undo_cells  = core_vec_size_create(),
+        .undo_values = core_vec_int_create(),
+        .index       = (int64_t) state->index,
+        .size        = tape_size,
+        .mask        = bf2c_options_cell_mask(options),
+    };
+    LOG_MSG_AND_ABORT_IF(!eval.cells || !eval.epochs, "Failed to allocate tape.");
+    for (size_t i = 0; i < state->cells.size; ++i) {
+        eval.cells[i] = (uint32_t) state->cells.data[i];
+    }
+
+    // the state after the last completed top-level command
+    size_t done        = 0;
+    int64_t done_index = eval.index;
+    size_t done_output = state->output.size;
+    size_t pc          = 0;
+    size_t depth       = 0;
+    for (uint64_t steps = 0; pc < program->commands.size && steps < options->eval_steps; ++steps) {
+        if (!bf2c_eval_step(&eval, program, &state->output, &pc, &depth)) {
+            break;
+        }
+        if (depth == 0) {
+            done        = pc;
+            done_index  = eval.index;
+            done_output = state->output.size;
+            bf2c_eval_commit(&eval);
+        }
+    }
+    bf2c_eval_rollback(&eval);
+    state->output.size = done_output;
+    LOG_DEBUG("Evaluated %zu of %zu commands", done, program->commands.size);
+
+    if (done > 0) {
+        size_t size = tape_size;
+        while (size > 0 && eval.cells[size - 1] == 0) {
+            --size;
+        }
+        core_vec_int_destroy(&state->cells);
+        state->cells = core_vec_int_with_capacity(size);
+        for (size_t i = 0; i < size; ++i) {
+            core_vec_int_push_back(&state->cells, (int32_t) eval.cells[i]);
+        }
+        state->index = (size_t) done_index;
+        command_vec_erase_front(&program->commands, done);
+        command_vec_shrink_to_fit(&program->commands);
+        bf2c_program_link_loops(program);
+    }
+    core_vec_size_destroy(&eval.undo_cells);
+    core_vec_int_destroy(&eval.undo_values);
+    free(eval.epochs);
+    free(eval.cells);
+}
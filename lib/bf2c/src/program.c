@@ -1,20 +1,35 @@
 #include "bf2c/program.h"
 
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "bf2c/command.h"
+#include "bf2c/source.h"
+#include "core/abort.h"
 #include "core/vector.h"
 
 program_t bf2c_program_create(command_vec_t commands) {
-    return (program_t){commands};
+    return (program_t){.commands = commands, .wide_deltas = command_wide_vec_create()};
 }
 
 void bf2c_program_destroy(program_t* program) {
     if (program) {
         command_vec_destroy(&program->commands);
+        command_wide_vec_destroy(&program->wide_deltas);
+        bf2c_source_unmap(&program->mapping);
+        core_vec_int_destroy(&program->state.cells);
+        core_vec_char_destroy(&program->state.output);
     }
 }
 
+bool bf2c_program_has_state(program_t const* program) {
+    ABORT_IF(!program);
+    return program->state.cells.size > 0 || program->state.index != 0 ||
+           program->state.output.size > 0;
+}
+
 void bf2c_program_print(program_t const* program) {
     int padding = 0;
     size_t size = program->commands.size;
@@ -22,11 +37,62 @@ void bf2c_program_print(program_t const* program) {
         padding++;
         size /= 10;
     }
-    VEC_FOR_EACH (command_t, cmd, program->commands) {
-        printf("[%*zu] Command: %s, Value: %d\n",
+    COMMAND_VEC_FOR_EACH (cmd, program->commands) {
+        bool const is_loop =
+            cmd.type == COMMAND_TYPE_LOOP_START || cmd.type == COMMAND_TYPE_LOOP_END;
+        printf("[%*zu] Command: %s, Value: %" PRId64 ", Offset: %" PRId32 "\n",
                padding,
                cmd_iterator,
                bf2c_command_type_to_string(cmd.type),
-               cmd.value);
+               is_loop ? bf2c_program_loop_delta(program, cmd_iterator) : (int64_t) cmd.value,
+               cmd.offset);
+    }
+}
+
+int64_t bf2c_program_loop_delta(program_t const* program, size_t index) {
+    ABORT_IF(!program || index >= program->commands.size);
+    int32_t const value = program->commands.values[index];
+    if (value != COMMAND_VALUE_WIDE) {
+        return value;
+    }
+    // binary search, the table only holds the (rare) loops spanning more than 2^31 commands
+    size_t low  = 0;
+    size_t high = program->wide_deltas.size;
+    while (low < high) {
+        size_t const mid = low + (high - low) / 2;
+        if (program->wide_deltas.data[mid].index < index) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    ABORT_IF(low == program->wide_deltas.size || program->wide_deltas.data[low].index != index);
+    return program->wide_deltas.data[low].value;
+}
+
+size_t bf2c_program_loop_match(program_t const* program, size_t index) {
+    return (size_t) ((int64_t) index + bf2c_program_loop_delta(program, index));
+}
+
+void bf2c_program_link_loops(program_t* program) {
+    ABORT_IF(!program);
+    command_wide_vec_clear(&program->wide_deltas);
+    core_vec_size_t open_loops = core_vec_size_create();
+    for (size_t i = 0; i < program->commands.size; ++i) {
+        command_type_t const type = (command_type_t) program->commands.types[i];
+        if (type == COMMAND_TYPE_LOOP_START) {
+            core_vec_size_push_back(&open_loops, i);
+        } else if (type == COMMAND_TYPE_LOOP_END) {
+            LOG_AND_ABORT_IF(core_vec_size_is_empty(&open_loops),
+                             "Unmatched loop end at index %zu",
+                             i);
+            size_t const start = core_vec_size_pop_back(&open_loops);
+            command_vec_link_loop(&program->commands, &program->wide_deltas, start, i);
+        }
     }
+    LOG_AND_ABORT_IF(!core_vec_size_is_empty(&open_loops),
+                     "Unmatched loop start at index %zu",
+                     open_loops.data[0]);
+    core_vec_size_destroy(&open_loops);
+    command_wide_vec_sort(&program->wide_deltas);
 }
@@ -0,0 +1,98 @@
+#include "bf2c/source.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "core/abort.h"
+
+#ifdef BF2C_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef BF2C_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+static bool bf2c_source_map(bf2c_source_t* source, char const* filename, bool writable) {
+    ABORT_IF(!source || !filename);
+    *source = (bf2c_source_t){0};
+#ifdef BF2C_HAVE_MMAP
+    int const fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        (void) close(fd);
+        return false;
+    }
+    if (info.st_size == 0) {
+        // mmap rejects empty mappings, but there is nothing to read anyway
+        (void) close(fd);
+        return true;
+    }
+    size_t const size = (size_t) info.st_size;
+    int const prot    = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* data        = mmap(NULL, size, prot, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after closing the descriptor
+    (void) close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+#ifdef MADV_SEQUENTIAL
+    (void) madvise(data, size, MADV_SEQUENTIAL);
+#endif
+    source->data      = (char const*) data;
+    source->size      = size;
+    source->is_mapped = true;
+    return true;
+#else
+    (void) writable;
+    return false;
+#endif
+}
+
+bool bf2c_source_map_file(bf2c_source_t* source, char const* filename) {
+    return bf2c_source_map(source, filename, false);
+}
+
+bool bf2c_source_map_file_private(bf2c_source_t* source, char const* filename) {
+    return bf2c_source_map(source, filename, true);
+}
+
+void bf2c_source_unmap(bf2c_source_t* source) {
+    if (!source) {
+        return;
+    }
+#ifdef BF2C_HAVE_MMAP
+    if (source->is_mapped) {
+        (void) munmap((void*) source->data, source->size);
+    }
+#endif
+    *source = (bf2c_source_t){0};
+}
+
+size_t bf2c_source_read_block(FILE* file, char* buffer, size_t size, bool* error) {
+    ABORT_IF(!file || !buffer || !error);
+    *error = false;
+#ifdef BF2C_HAVE_UNISTD_H
+    int const fd = fileno(file);
+    for (;;) {
+        ssize_t const ret_val = read(fd, buffer, size);
+        if (ret_val >= 0) {
+            return (size_t) ret_val;
+        }
+        if (errno != EINTR) {
+            *error = true;
+            return 0;
+        }
+    }
+#else
+    size_t const ret_val = fread(buffer, sizeof(buffer[0]), size, file);
+    *error               = ferror(file) != 0;
+    return ret_val;
+#endif
+}
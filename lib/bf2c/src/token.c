@@ -1,5 +1,25 @@
 #include "bf2c/token.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define BF2C_TOKEN_SSE2 1
+#define BF2C_TOKEN_AVX2 1
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <emmintrin.h>
+#include <intrin.h>
+#define BF2C_TOKEN_SSE2 1
+#endif
+
+enum {
+    // number of characters classified per SIMD step (one bit per character in a uint64_t)
+    TOKEN_BLOCK_SIZE = 64
+};
+
+typedef size_t (*token_filter_fn)(char const* source, size_t size, token_type_t* out);
+
 token_type_t bf2c_token_from_char(char source) {
     switch (source) {
         case '+': return TOKEN_PLUS;
@@ -34,3 +54,118 @@ char bf2c_token_to_char(token_type_t token) {
     }
     return '\0'; // should be unreachable
 }
+
+static size_t bf2c_token_filter_scalar(char const* source, size_t size, token_type_t* out) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; ++i) {
+        // branchless: always store, but only advance past actual tokens
+        token_type_t const token = bf2c_token_from_char(source[i]);
+        out[count]               = token;
+        count += token != TOKEN_COMMENT;
+    }
+    return count;
+}
+
+#ifdef BF2C_TOKEN_SSE2
+static inline unsigned bf2c_token_ctz(uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long index = 0;
+    _BitScanForward64(&index, mask);
+    return (unsigned) index;
+#else
+    return (unsigned) __builtin_ctzll(mask);
+#endif
+}
+
+// Write the tokens of all characters in `block` flagged by `mask`.
+static inline size_t bf2c_token_from_mask(char const* block, uint64_t mask, token_type_t* out) {
+    size_t count = 0;
+    while (mask) {
+        out[count++] = bf2c_token_from_char(block[bf2c_token_ctz(mask)]);
+        mask &= mask - 1;
+    }
+    return count;
+}
+
+// SSE2 is part of the x86-64 baseline, so this needs no runtime check.
+// Without a byte shuffle, every token character is compared separately.
+static inline uint64_t bf2c_token_mask_sse2(char const* block) {
+    static char const token_chars[] = {'+', '-', '<', '>', '[', ']', '.', ',', '#', '!'};
+    uint64_t mask                   = 0;
+    for (unsigned i = 0; i < TOKEN_BLOCK_SIZE / 16; ++i) {
+        __m128i const chunk = _mm_loadu_si128((__m128i const*) (void const*) (block + 16 * i));
+        __m128i hits        = _mm_setzero_si128();
+        for (size_t j = 0; j < sizeof(token_chars); ++j) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(token_chars[j])));
+        }
+        mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(hits) << (16 * i);
+    }
+    return mask;
+}
+
+static size_t bf2c_token_filter_sse2(char const* source, size_t size, token_type_t* out) {
+    size_t count  = 0;
+    size_t offset = 0;
+    for (; offset + TOKEN_BLOCK_SIZE <= size; offset += TOKEN_BLOCK_SIZE) {
+        uint64_t const mask = bf2c_token_mask_sse2(source + offset);
+        count += bf2c_token_from_mask(source + offset, mask, out + count);
+    }
+    return count + bf2c_token_filter_scalar(source + offset, size - offset, out + count);
+}
+#endif
+
+#ifdef BF2C_TOKEN_AVX2
+// All token characters have the high nibble 0x2, 0x3 or 0x5. Each high nibble gets one bit and the
+// low nibble table holds the bits of all high nibbles it forms a token with, e.g. 0xB is set for
+// 0x2B ('+') and 0x5B ('['). A character is a token iff both lookups share a bit.
+__attribute__((target("avx2"))) static inline uint64_t bf2c_token_mask_avx2(char const* block) {
+    // clang-format off
+    __m256i const lo_table = _mm256_setr_epi8(0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 5, 3, 5, 3, 0,
+                                              0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 5, 3, 5, 3, 0);
+    __m256i const hi_table = _mm256_setr_epi8(0, 0, 1, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 0, 1, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    // clang-format on
+    __m256i const nibble = _mm256_set1_epi8(0x0F);
+    uint64_t mask        = 0;
+    for (unsigned i = 0; i < TOKEN_BLOCK_SIZE / 32; ++i) {
+        __m256i const chunk = _mm256_loadu_si256((__m256i const*) (void const*) (block + 32 * i));
+        __m256i const lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(chunk, nibble));
+        __m256i const hi =
+            _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble));
+        __m256i const misses =
+            _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+        mask |= (uint64_t) (uint32_t) ~_mm256_movemask_epi8(misses) << (32 * i);
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) static size_t bf2c_token_filter_avx2(char const* source,
+                                                                      size_t size,
+                                                                      token_type_t* out) {
+    size_t count  = 0;
+    size_t offset = 0;
+    for (; offset + TOKEN_BLOCK_SIZE <= size; offset += TOKEN_BLOCK_SIZE) {
+        uint64_t const mask = bf2c_token_mask_avx2(source + offset);
+        count += bf2c_token_from_mask(source + offset, mask, out + count);
+    }
+    return count + bf2c_token_filter_scalar(source + offset, size - offset, out + count);
+}
+#endif
+
+static token_filter_fn bf2c_token_select_filter(void) {
+#ifdef BF2C_TOKEN_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return bf2c_token_filter_avx2;
+    }
+#endif
+#ifdef BF2C_TOKEN_SSE2
+    return bf2c_token_filter_sse2;
+#else
+    return bf2c_token_filter_scalar;
+#endif
+}
+
+size_t bf2c_token_filter(char const* source, size_t size, token_type_t* out) {
+    // The CPU check is cheap compared to a block, so it is not cached in a global.
+    return bf2c_token_select_filter()(source, size, out);
+}
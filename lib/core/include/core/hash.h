@@ -0,0 +1,12 @@
+#ifndef CORE_HASH_H_
+#define CORE_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fast non-cryptographic 64-bit hash (for checksums and cache keys, not for security).
+// Hashes can be chained by passing the previous hash as the seed.
+// The result depends on the byte order of the machine.
+uint64_t core_hash64(void const* data, size_t size, uint64_t seed);
+
+#endif /* ifndef CORE_HASH_H_ */
@@ -0,0 +1,39 @@
+#include "core/hash.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "core/abort.h"
+
+static uint64_t const HASH_PRIME_1 = 0x9E3779B185EBCA87ULL;
+static uint64_t const HASH_PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+
+static uint64_t core_hash_mix(uint64_t hash, uint64_t word) {
+    hash ^= word * HASH_PRIME_2;
+    hash = (hash << 31) | (hash >> 33);
+    return hash * HASH_PRIME_1;
+}
+
+uint64_t core_hash64(void const* data, size_t size, uint64_t seed) {
+    ABORT_IF(!data && size > 0);
+    unsigned char const* bytes = (unsigned char const*) data;
+    uint64_t hash              = seed ^ HASH_PRIME_1;
+    size_t i                   = 0;
+    // words are read with memcpy, the data does not need to be aligned
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = core_hash_mix(hash, word);
+    }
+    uint64_t tail = 0;
+    for (size_t shift = 0; i < size; ++i, shift += 8) {
+        tail |= (uint64_t) bytes[i] << shift;
+    }
+    hash = core_hash_mix(hash, tail ^ (uint64_t) size);
+    // final avalanche
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME_2;
+    hash ^= hash >> 29;
+    return hash;
+}